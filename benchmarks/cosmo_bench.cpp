@@ -0,0 +1,471 @@
+#include <cosmo.hpp>
+#include "stats/latency.hpp"
+#include "stats/phase_stats.hpp"
+#include "workload.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using cosmo::api::Cosmo;
+using cosmo::bench::Distribution;
+using cosmo::bench::KeyChooser;
+using cosmo::bench::Operation;
+using cosmo::bench::OPERATION_COUNT;
+using cosmo::bench::OPERATION_NAMES;
+using cosmo::bench::Workload;
+using cosmo::bench::keyName;
+using cosmo::storage::Histogram;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::string_view USAGE{
+        "usage: cosmo_bench [--workload=A..F] [--records=N] [--operations=N] [--threads=N]\n"
+        "                   [--value-size=BYTES] [--distribution=uniform|zipfian|latest]\n"
+        "                   [--read=P] [--update=P] [--insert=P] [--scan=P] [--rmw=P]\n"
+        "                   [--max-scan-length=N] [--max-data-file-size=BYTES] [--directory=PATH]\n"
+        "                   [--target-rate=OPS]\n"
+        "With --target-rate operations are issued open loop on a fixed schedule and latency is\n"
+        "measured from the scheduled send time, so stalls show up in the tail.\n"
+        "Builds configured with COSMO_PROFILE_PHASES also break reads and writes down by phase.\n"
+    };
+
+    struct Config {
+        char workload_name{ 'A' };
+        Workload workload{};
+        uint64_t records{ 100'000 };
+        uint64_t operations{ 1'000'000 };
+        size_t threads{ 1 };
+        size_t value_size{ 1'000 };
+        uint64_t max_data_file_size{ 256 * 1024 * 1024 };
+        fs::path directory{ fs::temp_directory_path() };
+        // Total operations per second across threads for open loop runs; 0 runs closed loop.
+        double target_rate{};
+    };
+
+    struct ThreadResult {
+        // From the scheduled send time in open loop runs, otherwise the same as service.
+        std::array<Histogram, OPERATION_COUNT> latencies{};
+        // From the moment the operation was actually issued.
+        std::array<Histogram, OPERATION_COUNT> service{};
+        std::array<uint64_t, OPERATION_COUNT> failures{};
+        // Operations issued later than scheduled because the thread was still busy.
+        uint64_t late{};
+    };
+
+    template<typename T>
+    std::optional<T> parseNumber(std::string_view text) {
+        T value{};
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc{} || end != text.data() + text.size()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    std::optional<Config> parseArguments(int argc, char** argv) {
+        std::map<std::string, std::string, std::less<>> arguments{};
+        for (int i = 1; i < argc; ++i) {
+            std::string_view argument{ argv[i] };
+            auto separator = argument.find('=');
+            if (!argument.starts_with("--") || separator == std::string_view::npos) {
+                return std::nullopt;
+            }
+            arguments.emplace(argument.substr(2, separator - 2), argument.substr(separator + 1));
+        }
+
+        Config config{};
+        bool valid{ true };
+
+        auto take = [&arguments](std::string_view name) -> std::optional<std::string> {
+            auto it = arguments.find(name);
+            if (it == arguments.end()) {
+                return std::nullopt;
+            }
+            auto value = std::move(it->second);
+            arguments.erase(it);
+            return value;
+        };
+
+        auto number = [&take, &valid]<typename T>(std::string_view name, T& out) {
+            if (auto text = take(name)) {
+                auto value = parseNumber<T>(*text);
+                valid = valid && value.has_value();
+                out = value.value_or(out);
+            }
+        };
+
+        if (auto name = take("workload")) {
+            config.workload_name = name->size() == 1 ? static_cast<char>(std::toupper(name->front())) : '?';
+        }
+        auto workload = cosmo::bench::standardWorkload(config.workload_name);
+        if (!workload) {
+            return std::nullopt;
+        }
+        config.workload = *workload;
+
+        if (auto name = take("distribution")) {
+            auto distribution = cosmo::bench::parseDistribution(*name);
+            valid = valid && distribution.has_value();
+            config.workload.distribution = distribution.value_or(config.workload.distribution);
+        }
+
+        for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+            number(OPERATION_NAMES[op], config.workload.proportions[op]);
+        }
+
+        number("records", config.records);
+        number("operations", config.operations);
+        number("threads", config.threads);
+        number("value-size", config.value_size);
+        number("max-scan-length", config.workload.max_scan_length);
+        number("max-data-file-size", config.max_data_file_size);
+        number("target-rate", config.target_rate);
+
+        if (auto directory = take("directory")) {
+            config.directory = *directory;
+        }
+
+        if (!valid || !arguments.empty() || config.records == 0 || config.threads == 0 || config.workload.max_scan_length == 0 || config.target_rate < 0) {
+            return std::nullopt;
+        }
+
+        return config;
+    }
+
+    // Splits [0, total) into contiguous per-thread ranges and runs body(thread, begin, end) on each.
+    template<typename Body>
+    void runThreads(size_t threads, uint64_t total, Body body) {
+        std::vector<std::thread> workers{};
+        for (size_t t = 0; t < threads; ++t) {
+            auto begin = total * t / threads;
+            auto end = total * (t + 1) / threads;
+            workers.emplace_back(body, t, begin, end);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    std::string makeValue(size_t size, uint64_t seed) {
+        std::string value(size, '\0');
+        std::mt19937_64 random{ seed };
+        for (auto& byte : value) {
+            byte = static_cast<char>('a' + random() % 26);
+        }
+        return value;
+    }
+
+    class Driver {
+    public:
+        Driver(Cosmo& cosmo, const Config& config) :
+            _cosmo{ cosmo }, _config{ config }, _chooser{ config.workload.distribution, config.records },
+            _key_count{ config.records } {
+
+            double sum{};
+            for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+                sum += config.workload.proportions[op];
+                _thresholds[op] = sum;
+            }
+            for (auto& threshold : _thresholds) {
+                threshold /= sum;
+            }
+        }
+
+        bool preload() {
+            std::atomic<bool> ok{ true };
+
+            runThreads(_config.threads, _config.records, [this, &ok](size_t thread, uint64_t begin, uint64_t end) {
+                auto value = makeValue(_config.value_size, thread);
+                for (auto index = begin; index < end && ok; ++index) {
+                    if (!_cosmo.put(keyName(index), value)) {
+                        ok = false;
+                    }
+                }
+            });
+
+            return ok;
+        }
+
+        // Closed loop issues the next operation as soon as the previous one returns. Open loop
+        // gives every thread a fixed schedule of send times; an operation that stalls delays the
+        // ones behind it, and that queueing is charged to them instead of silently skipped.
+        std::vector<ThreadResult> run() {
+            std::vector<ThreadResult> results(_config.threads);
+
+            auto open_loop = _config.target_rate > 0;
+            auto interval = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>{ open_loop ? static_cast<double>(_config.threads) / _config.target_rate : 0 });
+            auto run_start = Clock::now();
+
+            runThreads(_config.threads, _config.operations, [&](size_t thread, uint64_t begin, uint64_t end) {
+                std::mt19937_64 random{ 0x5eed + thread };
+                auto value = makeValue(_config.value_size, thread + _config.threads);
+                auto& result = results[thread];
+
+                // Threads are staggered so that together they send at an even pace.
+                Clock::time_point scheduled = run_start + interval * static_cast<Clock::rep>(thread) / static_cast<Clock::rep>(_config.threads);
+
+                for (auto i = begin; i < end; ++i, scheduled += interval) {
+                    auto op = nextOperation(random);
+
+                    if (open_loop) {
+                        if (Clock::now() < scheduled) {
+                            std::this_thread::sleep_until(scheduled);
+                        }
+                        else {
+                            ++result.late;
+                        }
+                    }
+
+                    auto start = Clock::now();
+                    auto ok = execute(op, random, value);
+                    auto finish = Clock::now();
+
+                    auto index = static_cast<size_t>(op);
+                    result.service[index].record(nanosBetween(start, finish));
+                    result.latencies[index].record(nanosBetween(open_loop ? scheduled : start, finish));
+                    result.failures[index] += ok ? 0 : 1;
+                }
+            });
+
+            return results;
+        }
+
+    private:
+        static uint64_t nanosBetween(Clock::time_point start, Clock::time_point finish) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count());
+        }
+
+        Cosmo& _cosmo;
+        const Config& _config;
+        KeyChooser _chooser;
+        std::array<double, OPERATION_COUNT> _thresholds{};
+        std::atomic<uint64_t> _key_count{};
+
+        Operation nextOperation(std::mt19937_64& random) const {
+            auto u = std::uniform_real_distribution<double>{}(random);
+            for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+                if (u < _thresholds[op]) {
+                    return static_cast<Operation>(op);
+                }
+            }
+            return Operation::Read;
+        }
+
+        // A read of a key whose insert is still in flight counts as a failure, like a miss.
+        bool execute(Operation op, std::mt19937_64& random, const std::string& value) {
+            auto key_count = _key_count.load(std::memory_order_relaxed);
+
+            switch (op) {
+            case Operation::Read:
+                return _cosmo.get(keyName(_chooser.next(random, key_count))).has_value();
+            case Operation::Update:
+                return _cosmo.put(keyName(_chooser.next(random, key_count)), value);
+            case Operation::Insert:
+                return _cosmo.put(keyName(_key_count.fetch_add(1, std::memory_order_relaxed)), value);
+            case Operation::Scan: {
+                auto first = _chooser.next(random, key_count);
+                auto length = std::uniform_int_distribution<uint64_t>{ 1, _config.workload.max_scan_length }(random);
+                bool found{ true };
+                for (uint64_t i = 0; i < length; ++i) {
+                    found = _cosmo.get(keyName((first + i) % key_count)).has_value() && found;
+                }
+                return found;
+            }
+            case Operation::ReadModifyWrite: {
+                auto key = keyName(_chooser.next(random, key_count));
+                auto current = _cosmo.get(key);
+                return current && _cosmo.put(key, value);
+            }
+            }
+            return false;
+        }
+    };
+
+    void printLatencies(std::string_view title, const std::array<Histogram, OPERATION_COUNT>& latencies,
+        const std::array<uint64_t, OPERATION_COUNT>& failures, double seconds) {
+
+        fmt::print("{}\n", title);
+        fmt::print("{:<10}{:>12}{:>10}{:>12}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n",
+            "operation", "count", "failed", "ops/s", "mean_us", "p50_us", "p95_us", "p99_us", "p999_us", "max_us");
+
+        auto micros = [](uint64_t nanos) { return static_cast<double>(nanos) / 1'000; };
+
+        for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+            const auto& histogram = latencies[op];
+            if (histogram.count() == 0) {
+                continue;
+            }
+
+            fmt::print("{:<10}{:>12}{:>10}{:>12.0f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}\n",
+                OPERATION_NAMES[op], histogram.count(), failures[op], static_cast<double>(histogram.count()) / seconds,
+                micros(histogram.mean()), micros(histogram.percentile(50)), micros(histogram.percentile(95)),
+                micros(histogram.percentile(99)), micros(histogram.percentile(99.9)), micros(histogram.max()));
+        }
+    }
+
+    void report(const Config& config, const std::vector<ThreadResult>& results, Clock::duration elapsed) {
+        std::array<Histogram, OPERATION_COUNT> latencies{};
+        std::array<Histogram, OPERATION_COUNT> service{};
+        std::array<uint64_t, OPERATION_COUNT> failures{};
+        uint64_t total{};
+        uint64_t late{};
+
+        for (const auto& result : results) {
+            for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+                latencies[op].merge(result.latencies[op]);
+                service[op].merge(result.service[op]);
+                failures[op] += result.failures[op];
+            }
+            late += result.late;
+        }
+        for (const auto& histogram : latencies) {
+            total += histogram.count();
+        }
+
+        auto seconds = std::chrono::duration<double>(elapsed).count();
+        fmt::print("workload {}: {} operations on {} threads in {:.2f} s, {:.0f} ops/s\n",
+            config.workload_name, total, config.threads, seconds, static_cast<double>(total) / seconds);
+
+        if (config.target_rate <= 0) {
+            printLatencies("latency", latencies, failures, seconds);
+            return;
+        }
+
+        fmt::print("open loop at {:.0f} ops/s, {} operations ({:.2f}%) issued behind schedule\n",
+            config.target_rate, late, total ? 100.0 * static_cast<double>(late) / static_cast<double>(total) : 0.0);
+        printLatencies("latency from scheduled send time", latencies, failures, seconds);
+        printLatencies("service time", service, failures, seconds);
+    }
+
+    void reportIo(const cosmo::api::IoStats& io) {
+        auto mib = [](uint64_t bytes) { return static_cast<double>(bytes) / (1024 * 1024); };
+        auto ratio = [](uint64_t numerator, uint64_t denominator) {
+            return denominator ? static_cast<double>(numerator) / static_cast<double>(denominator) : 0.0;
+        };
+
+        auto device_bytes = io.data_bytes_written + io.merge_bytes_written + io.hint_bytes_written;
+
+        fmt::print("io: user {:.1f} MiB, data {:.1f} MiB, merge {:.1f} MiB, hints {:.1f} MiB, merge read {:.1f} MiB, {} fsyncs\n",
+            mib(io.user_bytes_written), mib(io.data_bytes_written), mib(io.merge_bytes_written), mib(io.hint_bytes_written),
+            mib(io.merge_bytes_read), io.fsyncs);
+        fmt::print("space: {:.1f} MiB on disk, {:.1f} MiB live, write amplification {:.2f}, space amplification {:.2f}\n",
+            mib(io.disk_bytes), mib(io.live_bytes), ratio(device_bytes, io.user_bytes_written), ratio(io.disk_bytes, io.live_bytes));
+    }
+
+    // Mean nanoseconds per operation in each phase, over all threads and then per thread.
+    void reportPhases(const std::vector<cosmo::api::PhaseStats>& phases) {
+        if (phases.empty()) {
+            return;
+        }
+
+        auto row = [](std::string_view name, const cosmo::api::PhaseStats& stats) {
+            auto per_op = [&stats](uint64_t nanos) { return stats.operations ? static_cast<double>(nanos) / static_cast<double>(stats.operations) : 0.0; };
+            auto attributed = stats.lock_wait + stats.buffer_reserve + stats.copy + stats.syscall + stats.checksum + stats.index;
+
+            fmt::print("{:<12}{:>12}{:>10.0f}{:>11.0f}{:>16.0f}{:>9.0f}{:>9.0f}{:>10.0f}{:>7.0f}{:>7.0f}\n",
+                name, stats.operations, per_op(stats.total), per_op(stats.lock_wait), per_op(stats.buffer_reserve), per_op(stats.copy),
+                per_op(stats.syscall), per_op(stats.checksum), per_op(stats.index), per_op(stats.total - std::min(stats.total, attributed)));
+        };
+
+        fmt::print("phases (ns per operation)\n");
+        fmt::print("{:<12}{:>12}{:>10}{:>11}{:>16}{:>9}{:>9}{:>10}{:>7}{:>7}\n",
+            "operation", "count", "total", "lock_wait", "buffer_reserve", "memcpy", "syscall", "checksum", "index", "other");
+
+        for (std::string_view operation : { "read", "write" }) {
+            cosmo::api::PhaseStats sum{};
+            for (const auto& thread : phases) {
+                if (thread.operation != operation) {
+                    continue;
+                }
+
+                sum.operations += thread.operations;
+                sum.total += thread.total;
+                sum.lock_wait += thread.lock_wait;
+                sum.buffer_reserve += thread.buffer_reserve;
+                sum.copy += thread.copy;
+                sum.syscall += thread.syscall;
+                sum.checksum += thread.checksum;
+                sum.index += thread.index;
+            }
+
+            if (sum.operations == 0) {
+                continue;
+            }
+
+            row(operation, sum);
+            for (const auto& thread : phases) {
+                if (thread.operation == operation) {
+                    row(fmt::format("  thread {}", thread.thread), thread);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    auto config = parseArguments(argc, argv);
+    if (!config) {
+        fmt::print(stderr, "{}", USAGE);
+        return 2;
+    }
+
+    // The benchmark only ever touches its own subdirectory, which starts out empty.
+    auto data_directory = config->directory / "cosmo_bench_data";
+    std::error_code ec{};
+    fs::remove_all(data_directory, ec);
+    fs::create_directories(data_directory, ec);
+    if (ec) {
+        fmt::print(stderr, "cannot create {}: {}\n", data_directory.string(), ec.message());
+        return 1;
+    }
+
+    int status{};
+    {
+        cosmo::api::Options options{};
+        options.max_data_file_size = config->max_data_file_size;
+
+        Cosmo cosmo{ data_directory, options };
+        Driver driver{ cosmo, *config };
+
+        auto load_start = Clock::now();
+        if (!driver.preload()) {
+            fmt::print(stderr, "preloading {} records failed\n", config->records);
+            status = 1;
+        }
+        else {
+            fmt::print("loaded {} records of {} bytes in {:.2f} s\n", config->records, config->value_size,
+                std::chrono::duration<double>(Clock::now() - load_start).count());
+
+            cosmo::storage::phaseProfiler().reset();
+
+            auto run_start = Clock::now();
+            auto results = driver.run();
+            report(*config, results, Clock::now() - run_start);
+            auto stats = cosmo.getStats();
+            reportIo(stats.io);
+            reportPhases(stats.phases);
+        }
+    }
+
+    fs::remove_all(data_directory, ec);
+    return status;
+}
@@ -0,0 +1,273 @@
+#include <cosmo.hpp>
+#include "record/record.hpp"
+#include "storage.hpp"
+
+#include <fmt/format.h>
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+using cosmo::api::Cosmo;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::string_view USAGE{
+        "usage: recovery_bench [--segments=N,N,...] [--keys=N] [--value-size=BYTES] [--directory=PATH]\n"
+        "Builds a database of --keys keys spread over each segment count, then reopens it in a fresh\n"
+        "process, once from the data files alone and once after a merge wrote hint files.\n"
+    };
+
+    struct Config {
+        std::vector<uint64_t> segments{ 10, 100, 1'000, 4'000 };
+        uint64_t keys{ 1'000'000 };
+        size_t value_size{ 100 };
+        fs::path directory{ fs::temp_directory_path() };
+    };
+
+    // What the child process measures while opening a database.
+    struct OpenResult {
+        double storage_open_ms{};
+        double cosmo_open_ms{};
+        double first_read_ms{};
+        uint64_t keys{};
+        uint64_t peak_rss_kb{};
+    };
+
+    template<typename T>
+    bool parseNumber(std::string_view text, T& out) {
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+        return ec == std::errc{} && end == text.data() + text.size();
+    }
+
+    std::optional<Config> parseArguments(int argc, char** argv) {
+        Config config{};
+
+        for (int i = 1; i < argc; ++i) {
+            std::string_view argument{ argv[i] };
+            auto separator = argument.find('=');
+            if (!argument.starts_with("--") || separator == std::string_view::npos) {
+                return std::nullopt;
+            }
+
+            auto name = argument.substr(2, separator - 2);
+            auto text = argument.substr(separator + 1);
+
+            bool parsed{};
+            if (name == "segments") {
+                config.segments.clear();
+                parsed = true;
+                while (parsed && !text.empty()) {
+                    auto comma = std::min(text.find(','), text.size());
+                    uint64_t count{};
+                    parsed = parseNumber(text.substr(0, comma), count) && count > 0;
+                    config.segments.push_back(count);
+                    text.remove_prefix(std::min(comma + 1, text.size()));
+                }
+                parsed = parsed && !config.segments.empty();
+            }
+            else if (name == "keys") parsed = parseNumber(text, config.keys) && config.keys > 0;
+            else if (name == "value-size") parsed = parseNumber(text, config.value_size);
+            else if (name == "directory") {
+                config.directory = std::string{ text };
+                parsed = true;
+            }
+
+            if (!parsed) {
+                return std::nullopt;
+            }
+        }
+
+        return config;
+    }
+
+    std::string keyName(uint64_t index) {
+        return fmt::format("key{:012}", index);
+    }
+
+    double millisSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    uint64_t peakRssKb() {
+#ifdef _WIN32
+        return 0;
+#else
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return static_cast<uint64_t>(usage.ru_maxrss) / 1'024;
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+    }
+
+    // Runs in the child process so that peak RSS and the first read, which allocates the shared
+    // read buffer, are not skewed by building the database.
+    int openDatabase(const fs::path& directory, uint64_t max_data_file_size, uint64_t keys) {
+        OpenResult result{};
+
+        auto start = Clock::now();
+        {
+            cosmo::storage::Storage storage{ directory, max_data_file_size };
+            result.storage_open_ms = millisSince(start);
+        }
+
+        cosmo::api::Options options{};
+        options.max_data_file_size = max_data_file_size;
+
+        start = Clock::now();
+        Cosmo cosmo{ directory, options };
+        result.cosmo_open_ms = millisSince(start);
+
+        if (!cosmo.get(keyName(keys / 2))) {
+            return 1;
+        }
+        result.first_read_ms = millisSince(start);
+        result.keys = cosmo.size();
+        result.peak_rss_kb = peakRssKb();
+
+        fmt::print("{} {} {} {} {}\n", result.storage_open_ms, result.cosmo_open_ms, result.first_read_ms, result.keys, result.peak_rss_kb);
+        return 0;
+    }
+
+    std::optional<OpenResult> measureOpen(const char* self, const fs::path& directory, uint64_t max_data_file_size, uint64_t keys) {
+        auto command = fmt::format("\"{}\" --open=\"{}\" --max-data-file-size={} --keys={}", self, directory.string(), max_data_file_size, keys);
+
+        auto* child = popen(command.c_str(), "r");
+        if (!child) {
+            return std::nullopt;
+        }
+
+        OpenResult result{};
+        unsigned long long keys_found{};
+        unsigned long long peak_rss_kb{};
+        auto parsed = std::fscanf(child, "%lf %lf %lf %llu %llu", &result.storage_open_ms, &result.cosmo_open_ms, &result.first_read_ms,
+            &keys_found, &peak_rss_kb);
+
+        if (pclose(child) != 0 || parsed != 5) {
+            return std::nullopt;
+        }
+
+        result.keys = keys_found;
+        result.peak_rss_kb = peak_rss_kb;
+        return result;
+    }
+
+    uint64_t directorySize(const fs::path& directory) {
+        uint64_t size{};
+        for (const auto& entry : fs::directory_iterator{ directory }) {
+            size += entry.is_regular_file() ? entry.file_size() : 0;
+        }
+        return size;
+    }
+
+    void printRow(uint64_t segments, const Config& config, std::string_view hints, uint64_t disk_size, const OpenResult& result) {
+        auto mib = [](uint64_t bytes) { return static_cast<double>(bytes) / (1024 * 1024); };
+
+        fmt::print("{:>9}{:>10}{:>7}{:>10.1f}{:>14.1f}{:>14.1f}{:>12.1f}{:>14.1f}{:>10.1f}\n",
+            segments, config.keys, hints, mib(disk_size), result.storage_open_ms, result.cosmo_open_ms - result.storage_open_ms,
+            result.cosmo_open_ms, result.first_read_ms, mib(result.peak_rss_kb * 1'024));
+
+        if (result.keys != config.keys) {
+            fmt::print(stderr, "expected {} keys after recovery, found {}\n", config.keys, result.keys);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && std::string_view{ argv[1] }.starts_with("--open=")) {
+        uint64_t max_data_file_size{};
+        uint64_t keys{};
+        std::string_view size_argument{ argv[2] };
+        std::string_view keys_argument{ argv[3] };
+
+        if (!parseNumber(size_argument.substr(size_argument.find('=') + 1), max_data_file_size) ||
+            !parseNumber(keys_argument.substr(keys_argument.find('=') + 1), keys)) {
+            return 2;
+        }
+        return openDatabase(std::string{ std::string_view{ argv[1] }.substr(7) }, max_data_file_size, keys);
+    }
+
+    auto config = parseArguments(argc, argv);
+    if (!config) {
+        fmt::print(stderr, "{}", USAGE);
+        return 2;
+    }
+
+    auto directory = config->directory / "cosmo_recovery_bench";
+
+    fmt::print("{:>9}{:>10}{:>7}{:>10}{:>14}{:>14}{:>12}{:>14}{:>10}\n",
+        "segments", "keys", "hints", "disk_mib", "storage_ms", "keydir_ms", "open_ms", "first_read_ms", "rss_mib");
+
+    for (auto segments : config->segments) {
+        std::error_code ec{};
+        fs::remove_all(directory, ec);
+        fs::create_directories(directory);
+
+        // Sized so that the keys fill the requested number of immutable segments plus the active file.
+        auto record_size = keyName(0).size() + config->value_size + cosmo::storage::RecordHeader::MAX_SIZE;
+        auto max_data_file_size = std::max<uint64_t>(config->keys * record_size / segments, record_size);
+
+        {
+            cosmo::api::Options options{};
+            options.max_data_file_size = max_data_file_size;
+
+            Cosmo cosmo{ directory, options };
+            std::string value(config->value_size, 'v');
+
+            for (uint64_t i = 0; i < config->keys; ++i) {
+                if (!cosmo.put(keyName(i), value)) {
+                    fmt::print(stderr, "building {} segments failed\n", segments);
+                    return 1;
+                }
+            }
+        }
+
+        auto without_hints = measureOpen(argv[0], directory, max_data_file_size, config->keys);
+        if (!without_hints) {
+            fmt::print(stderr, "opening {} segments failed\n", segments);
+            return 1;
+        }
+        printRow(segments, *config, "no", directorySize(directory), *without_hints);
+
+        {
+            cosmo::api::Options options{};
+            options.max_data_file_size = max_data_file_size;
+
+            Cosmo cosmo{ directory, options };
+            if (!cosmo.merge()) {
+                fmt::print(stderr, "merging {} segments failed\n", segments);
+                return 1;
+            }
+        }
+
+        auto with_hints = measureOpen(argv[0], directory, max_data_file_size, config->keys);
+        if (!with_hints) {
+            fmt::print(stderr, "opening {} merged segments failed\n", segments);
+            return 1;
+        }
+        printRow(segments, *config, "yes", directorySize(directory), *with_hints);
+
+        fs::remove_all(directory, ec);
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "storage.hpp"
+#include "stats/latency.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using cosmo::storage::LatencyOp;
+using cosmo::storage::LatencyRecorder;
+using cosmo::storage::Storage;
+using cosmo::storage::StorageStrategyKind;
+using cosmo::storage::WriteLocation;
+
+namespace {
+    constexpr uint64_t MAX_DATA_FILE_SIZE{ 16 * 1024 * 1024 };
+    // Bytes preloaded for the read benchmarks, spread over a few data files.
+    constexpr uint64_t READ_SET_SIZE{ 32 * 1024 * 1024 };
+    constexpr size_t MIN_READ_SET_COUNT{ 256 };
+
+    // Shared by the threads of one benchmark run. Thread 0 builds it before the timed loop
+    // and tears it down after; the loop boundaries are barriers for all threads.
+    struct Run {
+        fs::path directory{};
+        std::unique_ptr<Storage> storage{};
+        std::unique_ptr<LatencyRecorder> latencies{};
+        std::string value{};
+        std::vector<WriteLocation> locations{};
+    };
+
+    Run run{};
+
+    void setUp(benchmark::State& state, StorageStrategyKind strategy, bool preload) {
+        if (state.thread_index() != 0) {
+            return;
+        }
+
+        run.directory = fs::temp_directory_path() / "cosmo_storage_benchmark";
+        fs::remove_all(run.directory);
+        fs::create_directories(run.directory);
+
+        run.storage = std::make_unique<Storage>(run.directory, MAX_DATA_FILE_SIZE, strategy);
+        run.latencies = std::make_unique<LatencyRecorder>();
+        run.value.assign(static_cast<size_t>(state.range(0)), 'x');
+        run.locations.clear();
+
+        if (!preload) {
+            return;
+        }
+
+        auto count = std::max<size_t>(READ_SET_SIZE / run.value.size(), MIN_READ_SET_COUNT);
+        for (size_t i = 0; i < count; ++i) {
+            auto location = run.storage->write(run.value);
+            if (!location) {
+                state.SkipWithError("preloading the read set failed");
+                return;
+            }
+            run.locations.push_back(*location);
+        }
+
+        if (!run.storage->flush()) {
+            state.SkipWithError("flushing the read set failed");
+            return;
+        }
+
+        // The first read allocates the process-wide read buffer; keep that out of the timed loop.
+        auto [file_id, pos] = run.locations.front();
+        if (!run.storage->read(file_id, pos, run.value.size())) {
+            state.SkipWithError("warming up the read buffer failed");
+        }
+    }
+
+    void tearDown(benchmark::State& state, LatencyOp op) {
+        auto value_size = static_cast<int64_t>(run.value.size());
+
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * value_size);
+
+        if (state.thread_index() != 0) {
+            return;
+        }
+
+        auto latency = run.latencies->summary(op);
+        auto micros = [](uint64_t nanos) { return static_cast<double>(nanos) / 1'000; };
+
+        state.counters["p50_us"] = micros(latency.p50);
+        state.counters["p99_us"] = micros(latency.p99);
+        state.counters["p999_us"] = micros(latency.p999);
+        state.counters["max_us"] = micros(latency.max);
+
+        run.storage.reset();
+        run.latencies.reset();
+        fs::remove_all(run.directory);
+    }
+
+    template<StorageStrategyKind Strategy>
+    void BM_Write(benchmark::State& state) {
+        setUp(state, Strategy, false);
+
+        for (auto _ : state) {
+            auto start = LatencyRecorder::Clock::now();
+            auto location = run.storage->write(run.value);
+            run.latencies->record(LatencyOp::Write, start);
+
+            if (!location) {
+                state.SkipWithError("write failed");
+                break;
+            }
+        }
+
+        tearDown(state, LatencyOp::Write);
+    }
+
+    // Single-threaded runs walk the read set in file order; concurrent runs pick values at random.
+    template<StorageStrategyKind Strategy>
+    void BM_Read(benchmark::State& state) {
+        setUp(state, Strategy, true);
+
+        std::minstd_rand random{ static_cast<uint32_t>(state.thread_index() + 1) };
+        size_t next{};
+        auto size = run.value.size();
+
+        for (auto _ : state) {
+            auto index = state.threads() == 1 ? next++ % run.locations.size() : random() % run.locations.size();
+            auto [file_id, pos] = run.locations[index];
+
+            auto start = LatencyRecorder::Clock::now();
+            auto value = run.storage->read(file_id, pos, size);
+            run.latencies->record(LatencyOp::Read, start);
+
+            if (!value) {
+                state.SkipWithError("read failed");
+                break;
+            }
+            benchmark::DoNotOptimize(*value);
+        }
+
+        tearDown(state, LatencyOp::Read);
+    }
+
+    void valueSizes(benchmark::internal::Benchmark* benchmark) {
+        benchmark->ArgName("value_size");
+        for (int64_t size : { 1 << 10, 4 << 10, 16 << 10, 64 << 10, 256 << 10 }) {
+            benchmark->Arg(size);
+        }
+        benchmark->ThreadRange(1, 8)->UseRealTime();
+    }
+}
+
+BENCHMARK(BM_Write<StorageStrategyKind::Basic>)->Apply(valueSizes);
+BENCHMARK(BM_Write<StorageStrategyKind::Buffered>)->Apply(valueSizes);
+BENCHMARK(BM_Read<StorageStrategyKind::Basic>)->Apply(valueSizes);
+BENCHMARK(BM_Read<StorageStrategyKind::Buffered>)->Apply(valueSizes);
+
+BENCHMARK_MAIN();
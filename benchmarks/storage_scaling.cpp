@@ -0,0 +1,277 @@
+#include "storage.hpp"
+#include "stats/latency.hpp"
+#include "stats/lock_stats.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace fs = std::filesystem;
+
+using cosmo::storage::Histogram;
+using cosmo::storage::Storage;
+using cosmo::storage::StorageStrategyKind;
+using cosmo::storage::WriteLocation;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::string_view USAGE{
+        "usage: storage_scaling [--max-threads=N] [--seconds=S] [--value-size=BYTES] [--read-set=BYTES]\n"
+        "Sweeps 1, 2, 4, ... max-threads threads over read-only, write-only and mixed (50/50) load\n"
+        "for each storage strategy and prints throughput, scaling efficiency and off-CPU time.\n"
+        "Builds configured with COSMO_PROFILE_LOCKS also report lock wait time and the most contended lock.\n"
+    };
+
+    enum class Mix : uint8_t {
+        Read = 0,
+        Write = 1,
+        Mixed = 2,
+    };
+
+    struct Config {
+        size_t max_threads{ std::max<size_t>(std::thread::hardware_concurrency(), 1) };
+        double seconds{ 2 };
+        size_t value_size{ 4'096 };
+        uint64_t read_set{ 64 * 1024 * 1024 };
+    };
+
+    struct Point {
+        uint64_t operations{};
+        double seconds{};
+        Histogram latencies{};
+        // Wall time the workers spent off CPU: blocked on a lock, in I/O or descheduled.
+        double off_cpu_seconds{};
+        double wall_seconds{};
+        double lock_wait_seconds{};
+        std::string top_lock{ "-" };
+    };
+
+    double threadCpuSeconds() {
+#ifdef _WIN32
+        FILETIME creation{}, exit{}, kernel{}, user{};
+        GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+        auto ticks = [](FILETIME time) { return (uint64_t{ time.dwHighDateTime } << 32) | time.dwLowDateTime; };
+        return static_cast<double>(ticks(kernel) + ticks(user)) / 1e7;
+#else
+        timespec time{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) / 1e9;
+#endif
+    }
+
+    std::optional<Config> parseArguments(int argc, char** argv) {
+        Config config{};
+
+        for (int i = 1; i < argc; ++i) {
+            std::string_view argument{ argv[i] };
+            auto separator = argument.find('=');
+            if (!argument.starts_with("--") || separator == std::string_view::npos) {
+                return std::nullopt;
+            }
+
+            auto name = argument.substr(2, separator - 2);
+            auto text = argument.substr(separator + 1);
+            auto parse = [text](auto& out) {
+                auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+                return ec == std::errc{} && end == text.data() + text.size();
+            };
+
+            bool parsed{};
+            if (name == "max-threads") parsed = parse(config.max_threads);
+            else if (name == "seconds") parsed = parse(config.seconds);
+            else if (name == "value-size") parsed = parse(config.value_size);
+            else if (name == "read-set") parsed = parse(config.read_set);
+
+            if (!parsed) {
+                return std::nullopt;
+            }
+        }
+
+        if (config.max_threads == 0 || config.seconds <= 0 || config.value_size == 0) {
+            return std::nullopt;
+        }
+
+        return config;
+    }
+
+    std::optional<Point> measure(const Config& config, const fs::path& directory, StorageStrategyKind strategy, Mix mix, size_t threads) {
+        fs::remove_all(directory);
+        fs::create_directories(directory);
+
+        Point point{};
+        {
+            Storage storage{ directory, 64 * 1024 * 1024, strategy };
+            std::string value(config.value_size, 'x');
+
+            std::vector<WriteLocation> locations{};
+            auto count = std::max<uint64_t>(config.read_set / config.value_size, 1);
+            for (uint64_t i = 0; i < count; ++i) {
+                auto location = storage.write(value);
+                if (!location) {
+                    return std::nullopt;
+                }
+                locations.push_back(*location);
+            }
+            if (!storage.flush() || !storage.read(locations[0].file_id, locations[0].pos, value.size())) {
+                return std::nullopt;
+            }
+
+            cosmo::storage::lockProfiler().reset();
+
+            std::atomic<bool> stop{};
+            std::atomic<size_t> ready{};
+            std::atomic<bool> failed{};
+            std::vector<Point> results(threads);
+            std::vector<std::thread> workers{};
+
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    std::minstd_rand random{ static_cast<uint32_t>(t + 1) };
+                    auto& result = results[t];
+
+                    ready.fetch_add(1);
+                    while (ready.load() < threads) {
+                        std::this_thread::yield();
+                    }
+
+                    auto wall_start = Clock::now();
+                    auto cpu_start = threadCpuSeconds();
+
+                    while (!stop.load(std::memory_order_relaxed)) {
+                        auto write = mix == Mix::Write || (mix == Mix::Mixed && (random() & 1));
+
+                        auto start = Clock::now();
+                        bool ok{};
+                        if (write) {
+                            ok = storage.write(value).has_value();
+                        }
+                        else {
+                            auto [file_id, pos] = locations[random() % locations.size()];
+                            ok = storage.read(file_id, pos, value.size()).has_value();
+                        }
+                        result.latencies.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+
+                        if (!ok) {
+                            failed = true;
+                            break;
+                        }
+                        ++result.operations;
+                    }
+
+                    result.wall_seconds = std::chrono::duration<double>(Clock::now() - wall_start).count();
+                    result.off_cpu_seconds = std::max(0.0, result.wall_seconds - (threadCpuSeconds() - cpu_start));
+                });
+            }
+
+            while (ready.load() < threads) {
+                std::this_thread::yield();
+            }
+            auto start = Clock::now();
+            std::this_thread::sleep_for(std::chrono::duration<double>{ config.seconds });
+            stop = true;
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            point.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            if (failed) {
+                return std::nullopt;
+            }
+
+            for (const auto& result : results) {
+                point.operations += result.operations;
+                point.latencies.merge(result.latencies);
+                point.off_cpu_seconds += result.off_cpu_seconds;
+                point.wall_seconds += result.wall_seconds;
+            }
+
+            double top_wait{};
+            for (const auto& lock : cosmo::storage::lockProfiler().stats()) {
+                auto wait = static_cast<double>(lock.wait.mean * lock.wait.count) / 1e9;
+                point.lock_wait_seconds += wait;
+
+                if (wait > top_wait) {
+                    top_wait = wait;
+                    point.top_lock = fmt::format("{}{}", cosmo::storage::LOCK_SITE_NAMES[static_cast<size_t>(lock.site)], lock.shared ? "/shared" : "");
+                }
+            }
+        }
+
+        fs::remove_all(directory);
+        return point;
+    }
+}
+
+int main(int argc, char** argv) {
+    auto config = parseArguments(argc, argv);
+    if (!config) {
+        fmt::print(stderr, "{}", USAGE);
+        return 2;
+    }
+
+    auto directory = fs::temp_directory_path() / "cosmo_storage_scaling";
+
+    constexpr std::pair<StorageStrategyKind, std::string_view> strategies[]{
+        { StorageStrategyKind::Basic, "basic" },
+        { StorageStrategyKind::Buffered, "buffered" },
+    };
+    constexpr std::pair<Mix, std::string_view> mixes[]{
+        { Mix::Read, "read" },
+        { Mix::Write, "write" },
+        { Mix::Mixed, "mixed" },
+    };
+
+    fmt::print("{:<10}{:<8}{:>8}{:>14}{:>10}{:>12}{:>10}{:>10}{:>10}{:>11}  {}\n",
+        "strategy", "mix", "threads", "ops/s", "speedup", "efficiency", "p50_us", "p99_us", "off_cpu", "lock_wait", "top_lock");
+
+    for (auto [strategy, strategy_name] : strategies) {
+        for (auto [mix, mix_name] : mixes) {
+            double baseline{};
+
+            for (size_t threads = 1; threads <= config->max_threads; threads *= 2) {
+                auto point = measure(*config, directory, strategy, mix, threads);
+                if (!point) {
+                    fmt::print(stderr, "{} {} on {} threads failed\n", strategy_name, mix_name, threads);
+                    return 1;
+                }
+
+                auto throughput = static_cast<double>(point->operations) / point->seconds;
+                baseline = threads == 1 ? throughput : baseline;
+                auto speedup = throughput / baseline;
+
+                auto share = [&point](double seconds) { return point->wall_seconds > 0 ? 100 * seconds / point->wall_seconds : 0.0; };
+
+                fmt::print("{:<10}{:<8}{:>8}{:>14.0f}{:>10.2f}{:>11.0f}%{:>10.1f}{:>10.1f}{:>9.0f}%{:>10}  {}\n",
+                    strategy_name, mix_name, threads, throughput, speedup, 100 * speedup / static_cast<double>(threads),
+                    static_cast<double>(point->latencies.percentile(50)) / 1'000,
+                    static_cast<double>(point->latencies.percentile(99)) / 1'000,
+                    share(point->off_cpu_seconds),
+                    cosmo::storage::LOCK_PROFILING ? fmt::format("{:.0f}%", share(point->lock_wait_seconds)) : "-",
+                    point->top_lock);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace cosmo::bench {
+    enum class Distribution : uint8_t {
+        Uniform = 0,
+        Zipfian = 1,
+        Latest = 2,
+    };
+
+    enum class Operation : uint8_t {
+        Read = 0,
+        Update = 1,
+        Insert = 2,
+        Scan = 3,
+        ReadModifyWrite = 4,
+    };
+
+    inline constexpr size_t OPERATION_COUNT{ 5 };
+
+    inline constexpr std::array<std::string_view, OPERATION_COUNT> OPERATION_NAMES{ "read", "update", "insert", "scan", "rmw" };
+
+    struct Workload {
+        std::array<double, OPERATION_COUNT> proportions{};
+        Distribution distribution{ Distribution::Zipfian };
+        size_t max_scan_length{ 100 };
+    };
+
+    // The core YCSB workloads. Cosmo has no ordered iteration, so a scan reads a run of
+    // consecutive key indices one get at a time.
+    inline std::optional<Workload> standardWorkload(char name) {
+        switch (name) {
+        case 'A': return Workload{ { 0.5, 0.5, 0, 0, 0 }, Distribution::Zipfian };
+        case 'B': return Workload{ { 0.95, 0.05, 0, 0, 0 }, Distribution::Zipfian };
+        case 'C': return Workload{ { 1, 0, 0, 0, 0 }, Distribution::Zipfian };
+        case 'D': return Workload{ { 0.95, 0, 0.05, 0, 0 }, Distribution::Latest };
+        case 'E': return Workload{ { 0, 0, 0.05, 0.95, 0 }, Distribution::Zipfian };
+        case 'F': return Workload{ { 0.5, 0, 0, 0, 0.5 }, Distribution::Zipfian };
+        default: return std::nullopt;
+        }
+    }
+
+    inline std::optional<Distribution> parseDistribution(std::string_view name) {
+        if (name == "uniform") return Distribution::Uniform;
+        if (name == "zipfian") return Distribution::Zipfian;
+        if (name == "latest") return Distribution::Latest;
+        return std::nullopt;
+    }
+
+    inline uint64_t fnv1a(uint64_t value) {
+        uint64_t hash{ 0xcbf29ce484222325 };
+        for (int i = 0; i < 8; ++i) {
+            hash ^= value & 0xff;
+            hash *= 0x100000001b3;
+            value >>= 8;
+        }
+        return hash;
+    }
+
+    // Hashed so that consecutive inserts do not land next to each other in key order.
+    inline std::string keyName(uint64_t index) {
+        return fmt::format("user{}", fnv1a(index));
+    }
+
+    // Zipfian ranks over [0, items) following Gray et al., "Quickly Generating Billion-Record
+    // Synthetic Databases", as YCSB does. Immutable once built, so threads can share one.
+    class ZipfianGenerator {
+    public:
+        static constexpr double DEFAULT_THETA{ 0.99 };
+
+        explicit ZipfianGenerator(uint64_t items, double theta = DEFAULT_THETA) :
+            _items{ std::max<uint64_t>(items, 2) }, _theta{ theta }, _alpha{ 1.0 / (1.0 - theta) },
+            _zeta_n{ zeta(_items, theta) },
+            _eta{ (1.0 - std::pow(2.0 / static_cast<double>(_items), 1.0 - theta)) / (1.0 - zeta(2, theta) / _zeta_n) } {}
+
+        template<typename Random>
+        uint64_t next(Random& random) const {
+            auto u = std::uniform_real_distribution<double>{}(random);
+            auto uz = u * _zeta_n;
+
+            if (uz < 1.0) {
+                return 0;
+            }
+            if (uz < 1.0 + std::pow(0.5, _theta)) {
+                return 1;
+            }
+
+            auto rank = static_cast<uint64_t>(static_cast<double>(_items) * std::pow(_eta * u - _eta + 1.0, _alpha));
+            return std::min(rank, _items - 1);
+        }
+
+    private:
+        uint64_t _items{};
+        double _theta{};
+        double _alpha{};
+        double _zeta_n{};
+        double _eta{};
+
+        static double zeta(uint64_t items, double theta) {
+            double sum{};
+            for (uint64_t i = 1; i <= items; ++i) {
+                sum += 1.0 / std::pow(static_cast<double>(i), theta);
+            }
+            return sum;
+        }
+    };
+
+    // Picks the index of an existing key. Zipfian ranks are scattered over the key space so the
+    // hot keys are not all neighbours; latest favours the most recently inserted keys.
+    class KeyChooser {
+    public:
+        KeyChooser(Distribution distribution, uint64_t items) :
+            _distribution{ distribution }, _zipfian{ items } {}
+
+        template<typename Random>
+        uint64_t next(Random& random, uint64_t key_count) const {
+            switch (_distribution) {
+            case Distribution::Uniform:
+                return std::uniform_int_distribution<uint64_t>{ 0, key_count - 1 }(random);
+            case Distribution::Zipfian:
+                return fnv1a(_zipfian.next(random)) % key_count;
+            case Distribution::Latest:
+                return key_count - 1 - std::min(_zipfian.next(random), key_count - 1);
+            }
+            return 0;
+        }
+
+    private:
+        Distribution _distribution{};
+        ZipfianGenerator _zipfian;
+    };
+}
@@ -1,8 +1,337 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cosmo::storage {
+    class Storage;
+    class KeyDir;
+    class TimerWheel;
+    class Scrubber;
+    class MetricsServer;
+}
 
 namespace cosmo::api {
+    // Bytes [begin, end) of an immutable data file that failed checksum verification.
+    struct CorruptRange {
+        uint32_t file_id{};
+        uint64_t begin{};
+        uint64_t end{};
+    };
+
+    struct ScrubStats {
+        uint64_t passes{};
+        uint64_t files_verified{};
+        uint64_t bytes_verified{};
+        uint64_t corrupt_ranges{};
+    };
+
+    // Latencies in nanoseconds; percentiles are within 1/64 of the exact value.
+    struct LatencyStats {
+        uint64_t count{};
+        uint64_t min{};
+        uint64_t mean{};
+        uint64_t p50{};
+        uint64_t p90{};
+        uint64_t p99{};
+        uint64_t p999{};
+        uint64_t max{};
+    };
+
+    // Byte counters since the database was opened, plus a snapshot of the space used.
+    // Write amplification is (data + merge + hint bytes written) / user bytes written,
+    // space amplification is disk bytes / live bytes.
+    struct IoStats {
+        uint64_t user_bytes_written{};
+        uint64_t data_bytes_written{};
+        uint64_t merge_bytes_written{};
+        uint64_t hint_bytes_written{};
+        uint64_t merge_bytes_read{};
+        uint64_t fsyncs{};
+        // Data, active and hint files.
+        uint64_t disk_bytes{};
+        // Keys and values the keydir points at; chunks of streamed values are not included.
+        uint64_t live_bytes{};
+    };
+
+    // Contention of one engine mutex, process-wide. Only collected in builds configured with
+    // COSMO_PROFILE_LOCKS; wait covers contended acquisitions only.
+    struct LockStats {
+        std::string site{};
+        bool shared{};
+        uint64_t acquisitions{};
+        uint64_t contended{};
+        LatencyStats wait{};
+        LatencyStats hold{};
+    };
+
+    // Where the reads or writes of one thread spent their time, in nanoseconds. A phase excludes
+    // the phases nested in it. Only collected in builds configured with COSMO_PROFILE_PHASES.
+    struct PhaseStats {
+        std::string operation{};
+        size_t thread{};
+        uint64_t operations{};
+        uint64_t total{};
+        uint64_t lock_wait{};
+        uint64_t buffer_reserve{};
+        uint64_t copy{};
+        uint64_t syscall{};
+        uint64_t checksum{};
+        uint64_t index{};
+    };
+
+    // Merges run since the database was opened and the progress of the current one.
+    struct MergeProgress {
+        uint64_t completed{};
+        bool running{};
+        // Data files of the current or last merge and how many of them it has gone through.
+        uint64_t files{};
+        uint64_t files_done{};
+    };
+
+    // Point-in-time state of the engine, read without taking any engine lock.
+    struct EngineGauges {
+        uint64_t keys{};
+        // Immutable data files, not counting the active one.
+        uint64_t data_files{};
+        uint64_t write_buffer_bytes{};
+        uint64_t write_buffer_capacity{};
+        MergeProgress merge{};
+    };
+
+    struct Stats {
+        LatencyStats read{};
+        LatencyStats write{};
+        LatencyStats flush{};
+        LatencyStats rollover{};
+        LatencyStats fsync{};
+        LatencyStats merge{};
+        IoStats io{};
+        EngineGauges gauges{};
+        std::vector<LockStats> locks{};
+        std::vector<PhaseStats> phases{};
+    };
+
+    enum class LogLevel : uint8_t {
+        Debug = 0,
+        Info = 1,
+        Warning = 2,
+        Error = 3,
+        Off = 4,
+    };
+
+    // Engine messages of every instance go through one background writer, so these are
+    // process-wide. The sink runs on that writer thread; by default lines go to stderr.
+    void setLogLevel(LogLevel level);
+
+    void setLogSink(std::function<void(LogLevel, std::string_view)> sink);
+
+    // Estimated bytes held by every instance in the process.
+    struct MemoryUsage {
+        uint64_t keydir{};
+        uint64_t write_buffers{};
+        uint64_t read_buffer{};
+        uint64_t total{};
+        uint64_t limit{};
+    };
+
+    // Caps the memory of every instance in the process together; 0, the default, removes the
+    // cap. Near the limit write buffers give their memory back after each flush and the shared
+    // read buffer stops growing. Keydir entries cannot be dropped, so once a new key no longer
+    // fits, writes that add keys fail.
+    void setMemoryLimit(uint64_t bytes);
+
+    MemoryUsage memoryUsage();
+
+    struct Options {
+        uint64_t max_data_file_size{ 1'000'000'000 };
+        uint32_t stream_chunk_size{ 1 << 20 };
+        // Read budget of the background scrubber; 0 leaves it off.
+        uint64_t scrub_bytes_per_second{};
+        std::chrono::milliseconds scrub_interval{ std::chrono::hours{ 1 } };
+        // Called from the scrubber thread, or from scrub(), for every corrupt range found.
+        std::function<void(const CorruptRange&)> on_corruption{};
+        // Serves getStats as Prometheus text on http://127.0.0.1:<port>/metrics; 0 picks a free port.
+        std::optional<uint16_t> metrics_port{};
+    };
+
+    class Cosmo;
+
+    // Appends a value of any size in chunks of Options::stream_chunk_size. Nothing is visible
+    // to readers until close() succeeds; a stream destroyed before that leaves only garbage
+    // chunks behind for merge to drop.
+    class WriteStream {
+    public:
+        WriteStream(WriteStream&& other) noexcept;
+        WriteStream& operator=(WriteStream&&) = delete;
+        ~WriteStream();
+
+        bool append(std::string_view data);
+
+        bool close();
+
+        uint64_t size() const;
+
+    private:
+        struct State;
+
+        explicit WriteStream(std::unique_ptr<State> state);
+
+        bool writeChunk(std::string_view bytes);
+
+        std::unique_ptr<State> _state;
+
+        friend class Cosmo;
+    };
+
+    // Reads a value chunk by chunk with memory bounded by the chunk size.
+    class ReadStream {
+    public:
+        ReadStream(ReadStream&& other) noexcept;
+        ReadStream& operator=(ReadStream&&) = delete;
+        ~ReadStream();
+
+        uint64_t size() const;
+
+        // Copies up to out.size() bytes and returns how many were read, 0 once the value is exhausted.
+        size_t read(std::span<char> out);
+
+        bool good() const;
+
+    private:
+        struct State;
+
+        explicit ReadStream(std::unique_ptr<State> state);
+
+        bool loadChunk();
+
+        std::unique_ptr<State> _state;
+
+        friend class Cosmo;
+    };
+
+    // Puts and deletes serialized up front and applied atomically by Cosmo::write.
+    class WriteBatch {
+    public:
+        WriteBatch();
+
+        void put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl = std::chrono::milliseconds::zero());
+
+        void del(std::string_view key);
+
+        size_t count() const { return _operations.size(); }
+
+        bool empty() const { return _operations.empty(); }
+
+    private:
+        struct Operation {
+            size_t key_pos{};
+            size_t key_size{};
+            size_t value_size{};
+            uint64_t expires_at{};
+            bool is_delete{};
+        };
+
+        std::string _records{};
+        std::vector<Operation> _operations{};
+
+        friend class Cosmo;
+    };
+
     class Cosmo {
+    public:
+        explicit Cosmo(const std::filesystem::path& directory, Options options = {});
+        ~Cosmo();
+
+        Cosmo(const Cosmo&) = delete;
+        Cosmo& operator=(const Cosmo&) = delete;
+
+        bool put(std::string_view key, std::string_view value);
+
+        // Stores a value that reads as missing once ttl has elapsed. A zero ttl never expires.
+        bool put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl);
+
+        std::optional<std::string> get(std::string_view key);
+
+        WriteStream openWriteStream(std::string_view key);
+
+        std::optional<ReadStream> openReadStream(std::string_view key);
+
+        // Appends the whole batch as one record and publishes it to the keydir at once.
+        bool write(WriteBatch&& batch);
+
+        // Appends a tombstone and forgets the key. Returns false if the key is not present.
+        bool del(std::string_view key);
+
+        // Rewrites every immutable data file keeping only live records, drops tombstones
+        // no older data file still needs and writes a hint file for each rewritten file.
+        bool merge();
+
+        // Drops at most max_batch expired keys from the keydir. Also runs on every put.
+        size_t evictExpired(size_t max_batch = EVICTION_BATCH);
+
+        // Number of keys in the keydir, including expired keys not evicted yet.
+        size_t size() const;
+
+        // Verifies the checksums of every immutable data file now, within the scrub budget if one
+        // is set. Returns the number of corrupt ranges found.
+        size_t scrub();
+
+        ScrubStats scrubStats() const;
+
+        // Makes every acknowledged write durable.
+        bool sync();
+
+        // Latencies and I/O volume of the storage operations since the database was opened.
+        Stats getStats() const;
+
+        // getStats and the scrub counters in the Prometheus text exposition format.
+        std::string metrics() const;
+
+        // Port of the metrics listener, 0 when Options::metrics_port is not set.
+        uint16_t metricsPort() const;
+
+    private:
+        void loadKeyDir();
+
+        // Whether the keydir may grow by those of keys it does not hold yet under the memory limit.
+        bool admitsKeys(std::span<const std::string_view> keys) const;
+
+        std::unique_ptr<storage::Storage> _storage;
+        std::unique_ptr<storage::KeyDir> _keydir;
+        std::unique_ptr<storage::TimerWheel> _expiry_timers;
+        std::unique_ptr<storage::Scrubber> _scrubber;
+
+        std::mutex _write_mtx;
+        std::mutex _merge_mtx;
+        // Odd while merge swaps a data file and repoints the keys it moved. Readers check it
+        // instead of taking a lock.
+        std::atomic<uint64_t> _merge_epoch{};
+
+        uint32_t _stream_chunk_size{};
+        std::atomic<size_t> _open_write_streams{};
+
+        std::atomic<uint64_t> _merges{};
+        std::atomic<bool> _merge_running{};
+        std::atomic<uint64_t> _merge_files{};
+        std::atomic<uint64_t> _merge_files_done{};
+
+        // Last, so the listener stops before anything it reads is destroyed.
+        std::unique_ptr<storage::MetricsServer> _metrics_server;
+
+        static constexpr size_t EVICTION_BATCH{ 64 };
+
+        friend class WriteStream;
+        friend class ReadStream;
     };
-}
\ No newline at end of file
+}
@@ -1 +1,1037 @@
-#include <cosmo.hpp>
\ No newline at end of file
+#include <cosmo.hpp>
+
+#include "storage.hpp"
+#include "admin/metrics_server.hpp"
+#include "keydir/keydir.hpp"
+#include "keydir/timer_wheel.hpp"
+#include "log/logger.hpp"
+#include "record/record.hpp"
+#include "scrub/scrubber.hpp"
+#include "trace/probes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fmt/format.h>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+namespace cosmo::api {
+    using storage::data_file_id_t;
+    using storage::data_file_size_t;
+    using storage::HintEntry;
+    using storage::IoCounter;
+    using storage::KeyDirEntry;
+    using storage::offset_t;
+    using storage::Phase;
+    using storage::PhaseOp;
+    using storage::PhaseOperation;
+    using storage::PhaseTimer;
+    using storage::RecordHeader;
+    using storage::RecordType;
+    using storage::RecordView;
+    using storage::TimerWheel;
+
+    namespace {
+        // Merge output is gathered into blocks of this size before it is written.
+        constexpr size_t MERGE_WRITE_SIZE{ 1024 * 1024 };
+
+        uint64_t nowMillis() {
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+        }
+
+        std::optional<std::string> readBytes(storage::Storage& storage, const storage::SegmentTable::Snapshot& data_files,
+            data_file_id_t file_id, offset_t pos, data_file_size_t size) {
+            auto buffer = storage.read(data_files, file_id, pos, size);
+            if (!buffer) {
+                return std::nullopt;
+            }
+
+            PhaseTimer timer{ Phase::Copy };
+            return std::string{ *buffer, size };
+        }
+
+        // Opens path as an empty file, dropping whatever an interrupted merge left in it.
+        storage::Result<storage::ConcurrentFile> createFile(const fs::path& path) {
+            auto file = storage::ConcurrentFile::open(path);
+            if (!file) {
+                return file.error();
+            }
+
+            if (auto truncated = file->truncate(0); !truncated) {
+                return truncated.error();
+            }
+
+            return file;
+        }
+
+        std::optional<storage::BlobManifest> readManifest(storage::Storage& storage, const storage::SegmentTable::Snapshot& data_files,
+            const KeyDirEntry& entry) {
+            auto encoded = readBytes(storage, data_files, entry.file_id, entry.value_pos, entry.value_size);
+
+            storage::BlobManifest manifest{};
+            if (!encoded || !storage::decodeBlobManifest(*encoded, manifest)) {
+                return std::nullopt;
+            }
+
+            return manifest;
+        }
+
+        std::optional<std::set<std::pair<data_file_id_t, offset_t>>> liveBlobChunks(storage::Storage& storage, const storage::KeyDir& keydir) {
+            std::vector<KeyDirEntry> blobs{};
+            keydir.forEach([&blobs](std::string_view, const KeyDirEntry& entry) {
+                if (entry.is_blob) {
+                    blobs.push_back(entry);
+                }
+            });
+
+            auto data_files = storage.getDataFiles();
+
+            std::set<std::pair<data_file_id_t, offset_t>> live{};
+            for (const auto& entry : blobs) {
+                auto manifest = readManifest(storage, data_files, entry);
+                if (!manifest) {
+                    return std::nullopt;
+                }
+
+                for (const auto& chunk : manifest->chunks) {
+                    live.emplace(chunk.file_id, chunk.value_pos);
+                }
+            }
+
+            return live;
+        }
+
+        // Runs read until it did not overlap merge swapping a data file. Readers take no lock, so
+        // one that did may have paired a keydir entry with the file from the other side of the swap.
+        template <typename Read>
+        auto readConsistent(const std::atomic<uint64_t>& merge_epoch, Read read) {
+            while (true) {
+                auto epoch = merge_epoch.load();
+                if (epoch % 2 == 0) {
+                    auto result = read();
+                    if (merge_epoch.load() == epoch) {
+                        return result;
+                    }
+                }
+
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    struct WriteStream::State {
+        Cosmo& cosmo;
+        std::string key{};
+        uint32_t chunk_size{};
+        std::string chunk{};
+        storage::BlobManifest manifest{};
+        bool open{ true };
+        bool failed{};
+    };
+
+    WriteStream::WriteStream(std::unique_ptr<State> state) : _state{ std::move(state) } {
+        _state->chunk.reserve(_state->chunk_size);
+        ++_state->cosmo._open_write_streams;
+    }
+
+    WriteStream::WriteStream(WriteStream&& other) noexcept = default;
+
+    WriteStream::~WriteStream() {
+        if (_state && _state->open) {
+            --_state->cosmo._open_write_streams;
+        }
+    }
+
+    bool WriteStream::append(std::string_view data) {
+        if (!_state->open || _state->failed) {
+            return false;
+        }
+
+        while (!data.empty()) {
+            // Whole chunks of caller data go straight to storage without passing through the chunk buffer.
+            if (_state->chunk.empty() && data.size() >= _state->chunk_size) {
+                if (!writeChunk(data.substr(0, _state->chunk_size))) {
+                    return false;
+                }
+                data.remove_prefix(_state->chunk_size);
+                continue;
+            }
+
+            auto count = std::min<size_t>(data.size(), _state->chunk_size - _state->chunk.size());
+            _state->chunk.append(data.substr(0, count));
+            data.remove_prefix(count);
+
+            if (_state->chunk.size() == _state->chunk_size) {
+                if (!writeChunk(_state->chunk)) {
+                    return false;
+                }
+                _state->chunk.clear();
+            }
+        }
+
+        return true;
+    }
+
+    bool WriteStream::close() {
+        if (!_state->open) {
+            return false;
+        }
+
+        _state->open = false;
+        --_state->cosmo._open_write_streams;
+
+        if (_state->failed || (!_state->chunk.empty() && !writeChunk(_state->chunk))) {
+            return false;
+        }
+        _state->chunk.clear();
+
+        auto& cosmo = _state->cosmo;
+        std::string_view key{ _state->key };
+        if (!cosmo.admitsKeys({ &key, 1 })) {
+            return false;
+        }
+
+        auto manifest = storage::encodeBlobManifest(_state->manifest);
+        auto record = storage::encodeRecord(RecordType::Blob, key, manifest);
+
+        std::scoped_lock lck{ cosmo._write_mtx };
+
+        auto location = cosmo._storage->write(record);
+        if (!location) {
+            return false;
+        }
+
+        auto [file_id, pos] = *location;
+        cosmo._keydir->put(key, { file_id, pos + record.size() - manifest.size(), manifest.size(), 0, true });
+        cosmo._storage->recordIo(IoCounter::UserBytesWritten, key.size());
+
+        return true;
+    }
+
+    uint64_t WriteStream::size() const {
+        return _state->manifest.total_size + _state->chunk.size();
+    }
+
+    bool WriteStream::writeChunk(std::string_view bytes) {
+        std::string header{};
+        header.reserve(RecordHeader::MAX_SIZE + _state->key.size());
+        storage::appendRecordHeader(header, RecordType::Chunk, _state->key, bytes);
+
+        const storage::IoSlice record[]{ { header.data(), header.size() }, { bytes.data(), bytes.size() } };
+
+        auto location = _state->cosmo._storage->write(record);
+        if (!location) {
+            _state->failed = true;
+            return false;
+        }
+
+        auto [file_id, pos] = *location;
+        _state->manifest.chunks.push_back({ file_id, pos + header.size(), bytes.size() });
+        _state->manifest.total_size += bytes.size();
+        _state->cosmo._storage->recordIo(IoCounter::UserBytesWritten, bytes.size());
+
+        return true;
+    }
+
+    struct ReadStream::State {
+        storage::Storage& storage;
+        storage::SegmentTable::Snapshot segments{};
+        storage::BlobManifest manifest{};
+        size_t next_chunk{};
+        std::string chunk{};
+        size_t chunk_pos{};
+        bool failed{};
+    };
+
+    ReadStream::ReadStream(std::unique_ptr<State> state) : _state{ std::move(state) } {}
+
+    ReadStream::ReadStream(ReadStream&& other) noexcept = default;
+
+    ReadStream::~ReadStream() = default;
+
+    uint64_t ReadStream::size() const {
+        return _state->manifest.total_size;
+    }
+
+    size_t ReadStream::read(std::span<char> out) {
+        size_t copied{};
+
+        while (copied < out.size()) {
+            if (_state->chunk_pos == _state->chunk.size() && !loadChunk()) {
+                break;
+            }
+
+            auto count = std::min(out.size() - copied, _state->chunk.size() - _state->chunk_pos);
+            std::memcpy(out.data() + copied, _state->chunk.data() + _state->chunk_pos, count);
+
+            copied += count;
+            _state->chunk_pos += count;
+        }
+
+        return copied;
+    }
+
+    bool ReadStream::good() const {
+        return !_state->failed;
+    }
+
+    bool ReadStream::loadChunk() {
+        if (_state->failed || _state->next_chunk >= _state->manifest.chunks.size()) {
+            return false;
+        }
+
+        const auto& chunk = _state->manifest.chunks[_state->next_chunk++];
+
+        // Chunks of immutable files are read through the snapshot taken at open, which keeps their files alive.
+        auto buffer = _state->storage.read(_state->segments, chunk.file_id, chunk.value_pos, chunk.size);
+
+        if (!buffer) {
+            _state->failed = true;
+            return false;
+        }
+
+        _state->chunk.assign(*buffer, chunk.size);
+        _state->chunk_pos = 0;
+
+        return true;
+    }
+
+    void setLogLevel(LogLevel level) {
+        storage::sharedLogger().setLevel(static_cast<storage::LogLevel>(level));
+    }
+
+    void setLogSink(std::function<void(LogLevel, std::string_view)> sink) {
+        if (!sink) {
+            storage::sharedLogger().setSink({});
+            return;
+        }
+
+        storage::sharedLogger().setSink([sink = std::move(sink)](storage::LogLevel level, std::string_view line) {
+            sink(static_cast<LogLevel>(level), line);
+        });
+    }
+
+    WriteBatch::WriteBatch() {
+        _records.resize(storage::BATCH_HEADER_SIZE);
+    }
+
+    void WriteBatch::put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+        uint64_t expires_at = ttl.count() > 0 ? nowMillis() + static_cast<uint64_t>(ttl.count()) : 0;
+
+        storage::appendRecord(_records, RecordType::Put, key, value, expires_at);
+        _operations.push_back({ _records.size() - value.size() - key.size(), key.size(), value.size(), expires_at, false });
+    }
+
+    void WriteBatch::del(std::string_view key) {
+        storage::appendRecord(_records, RecordType::Tombstone, key, {});
+        _operations.push_back({ _records.size() - key.size(), key.size(), 0, 0, true });
+    }
+
+    void setMemoryLimit(uint64_t bytes) {
+        storage::memoryBudget().setLimit(bytes);
+    }
+
+    MemoryUsage memoryUsage() {
+        const auto& budget = storage::memoryBudget();
+
+        return {
+            budget.used(storage::MemoryComponent::KeyDir),
+            budget.used(storage::MemoryComponent::WriteBuffer),
+            budget.used(storage::MemoryComponent::ReadBuffer),
+            budget.used(),
+            budget.limit(),
+        };
+    }
+
+    Cosmo::Cosmo(const std::filesystem::path& directory, Options options) :
+        _storage{ std::make_unique<storage::Storage>(directory, options.max_data_file_size) },
+        _keydir{ std::make_unique<storage::KeyDir>() },
+        _expiry_timers{ std::make_unique<TimerWheel>(nowMillis()) },
+        _scrubber{ std::make_unique<storage::Scrubber>(*_storage, options.scrub_bytes_per_second,
+            [on_corruption = std::move(options.on_corruption)](data_file_id_t file_id, offset_t begin, offset_t end) {
+                if (on_corruption) {
+                    on_corruption({ file_id, begin, end });
+                }
+            }) },
+        _stream_chunk_size{ static_cast<uint32_t>(std::max<uint64_t>(1, std::min<uint64_t>(options.stream_chunk_size, options.max_data_file_size / 2))) } {
+        loadKeyDir();
+
+        if (options.scrub_bytes_per_second > 0) {
+            _scrubber->start(options.scrub_interval);
+        }
+
+        if (options.metrics_port) {
+            _metrics_server = std::make_unique<storage::MetricsServer>([this] { return metrics(); });
+
+            if (auto started = _metrics_server->start(*options.metrics_port); !started) {
+                throw std::system_error(started.error(), fmt::format("Unable to serve metrics on port {}", *options.metrics_port));
+            }
+        }
+    }
+
+    Cosmo::~Cosmo() = default;
+
+    bool Cosmo::put(std::string_view key, std::string_view value) {
+        return put(key, value, std::chrono::milliseconds::zero());
+    }
+
+    bool Cosmo::put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+        PhaseOperation operation{ PhaseOp::Write };
+
+        if (!admitsKeys({ &key, 1 })) {
+            return false;
+        }
+
+        uint64_t expires_at = ttl.count() > 0 ? nowMillis() + static_cast<uint64_t>(ttl.count()) : 0;
+        std::string header{};
+        header.reserve(RecordHeader::MAX_SIZE + key.size());
+        {
+            PhaseTimer timer{ Phase::Checksum };
+            storage::appendRecordHeader(header, RecordType::Put, key, value, expires_at);
+        }
+
+        const storage::IoSlice record[]{ { header.data(), header.size() }, { value.data(), value.size() } };
+
+        {
+            auto lck = storage::lockTimed<std::scoped_lock>(_write_mtx);
+
+            auto location = _storage->write(record);
+            if (!location) {
+                return false;
+            }
+
+            auto [file_id, pos] = *location;
+            {
+                PhaseTimer timer{ Phase::Index };
+                _keydir->put(key, { file_id, pos + header.size(), value.size(), expires_at });
+            }
+            _storage->recordIo(IoCounter::UserBytesWritten, key.size() + value.size());
+        }
+
+        if (expires_at) {
+            _expiry_timers->schedule(std::string{ key }, expires_at);
+        }
+
+        evictExpired();
+
+        return true;
+    }
+
+    std::optional<std::string> Cosmo::get(std::string_view key) {
+        PhaseOperation operation{ PhaseOp::Read };
+
+        return readConsistent(_merge_epoch, [this, key]() -> std::optional<std::string> {
+            auto data_files = _storage->getDataFiles();
+
+            auto entry = [this, key] {
+                PhaseTimer timer{ Phase::Index };
+                return _keydir->get(key);
+            }();
+            if (!entry || entry->isExpired(nowMillis())) {
+                return std::nullopt;
+            }
+
+            if (!entry->is_blob) {
+                return readBytes(*_storage, data_files, entry->file_id, entry->value_pos, entry->value_size);
+            }
+
+            auto manifest = readManifest(*_storage, data_files, *entry);
+            if (!manifest) {
+                return std::nullopt;
+            }
+
+            std::string value{};
+            value.reserve(manifest->total_size);
+
+            for (const auto& chunk : manifest->chunks) {
+                auto buffer = _storage->read(data_files, chunk.file_id, chunk.value_pos, chunk.size);
+                if (!buffer) {
+                    return std::nullopt;
+                }
+
+                value.append(*buffer, chunk.size);
+            }
+
+            return value;
+        });
+    }
+
+    WriteStream Cosmo::openWriteStream(std::string_view key) {
+        return WriteStream{ std::make_unique<WriteStream::State>(WriteStream::State{ *this, std::string{ key }, _stream_chunk_size }) };
+    }
+
+    std::optional<ReadStream> Cosmo::openReadStream(std::string_view key) {
+        return readConsistent(_merge_epoch, [this, key]() -> std::optional<ReadStream> {
+            auto state = std::make_unique<ReadStream::State>(ReadStream::State{ *_storage, _storage->getDataFiles() });
+
+            auto entry = _keydir->get(key);
+            if (!entry || entry->isExpired(nowMillis())) {
+                return std::nullopt;
+            }
+
+            if (entry->is_blob) {
+                auto manifest = readManifest(*_storage, state->segments, *entry);
+                if (!manifest) {
+                    return std::nullopt;
+                }
+
+                state->manifest = std::move(*manifest);
+            }
+            else {
+                // Plain values are small enough to be read whole up front.
+                auto value = readBytes(*_storage, state->segments, entry->file_id, entry->value_pos, entry->value_size);
+                if (!value) {
+                    return std::nullopt;
+                }
+
+                state->manifest.total_size = value->size();
+                state->chunk = std::move(*value);
+            }
+
+            return ReadStream{ std::move(state) };
+        });
+    }
+
+    bool Cosmo::write(WriteBatch&& batch) {
+        if (batch.empty()) {
+            return true;
+        }
+
+        std::vector<std::string_view> keys{};
+        for (const auto& operation : batch._operations) {
+            if (!operation.is_delete) {
+                keys.emplace_back(batch._records.data() + operation.key_pos, operation.key_size);
+            }
+        }
+
+        if (!admitsKeys(keys)) {
+            return false;
+        }
+
+        storage::sealBatch(batch._records, static_cast<uint32_t>(batch.count()));
+
+        std::vector<std::pair<std::string_view, std::optional<KeyDirEntry>>> updates{};
+        updates.reserve(batch.count());
+
+        {
+            std::scoped_lock lck{ _write_mtx };
+
+            auto location = _storage->write(batch._records);
+            if (!location) {
+                return false;
+            }
+
+            auto [file_id, pos] = *location;
+            for (const auto& operation : batch._operations) {
+                std::string_view key{ batch._records.data() + operation.key_pos, operation.key_size };
+                _storage->recordIo(IoCounter::UserBytesWritten, operation.key_size + operation.value_size);
+
+                if (operation.is_delete) {
+                    updates.emplace_back(key, std::nullopt);
+                }
+                else {
+                    auto value_pos = pos + operation.key_pos + operation.key_size;
+                    updates.emplace_back(key, KeyDirEntry{ file_id, value_pos, operation.value_size, operation.expires_at });
+                }
+            }
+
+            _keydir->publish(updates);
+        }
+
+        for (const auto& [key, entry] : updates) {
+            if (entry && entry->expires_at) {
+                _expiry_timers->schedule(std::string{ key }, entry->expires_at);
+            }
+        }
+
+        evictExpired();
+
+        return true;
+    }
+
+    bool Cosmo::del(std::string_view key) {
+        std::scoped_lock lck{ _write_mtx };
+
+        auto entry = _keydir->get(key);
+        if (!entry || entry->isExpired(nowMillis())) {
+            return false;
+        }
+
+        if (!_storage->writeOwned(storage::encodeRecord(RecordType::Tombstone, key, {}))) {
+            return false;
+        }
+        _storage->recordIo(IoCounter::UserBytesWritten, key.size());
+
+        return _keydir->erase(key);
+    }
+
+    bool Cosmo::merge() {
+        std::scoped_lock merge_lck{ _merge_mtx };
+
+        auto start = storage::LatencyRecorder::Clock::now();
+
+        auto data_files = _storage->getDataFiles();
+        auto now = nowMillis();
+
+        COSMO_PROBE1(merge_start, data_files.size());
+
+        _merge_files = data_files.size();
+        _merge_files_done = 0;
+        _merge_running = true;
+
+        // Keys still present in the data files rewritten so far. A tombstone is only kept
+        // while one of those older files holds a record for its key.
+        std::unordered_set<std::string> older_keys{};
+        bool keep_tombstones{};
+
+        // Streamed values reference their chunks by position, so a file holding a live chunk
+        // is never rewritten. While a stream is open its chunks are not referenced yet and
+        // every chunk counts as live.
+        auto pin_all_chunks = _open_write_streams.load() > 0;
+        auto live_chunks = liveBlobChunks(*_storage, *_keydir);
+        pin_all_chunks = pin_all_chunks || !live_chunks;
+
+        for (data_file_id_t id = 0; id < data_files.size(); ++id) {
+            _merge_files_done = id;
+
+            const auto& data_file_path = data_files.at(id).getPath();
+            auto merge_file_path = _storage->getMergeFilePath(id);
+            auto hint_file_path = _storage->getHintFilePath(id);
+            auto hint_tmp_path = fs::path{ hint_file_path }.concat(".tmp");
+
+            std::vector<std::tuple<std::string, KeyDirEntry, KeyDirEntry>> moved{};
+            std::vector<std::string> kept_keys{};
+            std::vector<std::string> scanned_keys{};
+            std::string hints(storage::HINT_HEADER_SIZE, '\0');
+            uint64_t merged_size{};
+            bool pinned{};
+
+            auto fail = [&](std::string_view action, const fs::path& path, std::error_code error) {
+                storage::sharedLogger().log(storage::LogLevel::Error, storage::LogEvent::Merge, "{} {} failed: {}",
+                    action, path, storage::ErrorText{ error });
+
+                std::error_code ec{};
+                fs::remove(merge_file_path, ec);
+                fs::remove(hint_tmp_path, ec);
+
+                _merge_running = false;
+
+                COSMO_PROBE1(merge_done, false);
+                return false;
+            };
+
+            auto merge_file = createFile(merge_file_path);
+            if (!merge_file) {
+                return fail("creating", merge_file_path, merge_file.error());
+            }
+
+            std::string pending{};
+            std::error_code write_error{};
+            auto writePending = [&] {
+                if (!write_error && !pending.empty()) {
+                    if (auto written = merge_file->write(pending.data(), static_cast<std::streamsize>(pending.size())); !written) {
+                        write_error = written.error();
+                    }
+                }
+                pending.clear();
+            };
+
+            auto valid_size = storage::scanRecords(data_file_path, [&](const RecordView& record) {
+                auto value_size = record.value.size();
+                auto type = record.type;
+                KeyDirEntry current{ id, record.valuePos(), value_size, record.expires_at, type == RecordType::Blob };
+
+                scanned_keys.emplace_back(record.key);
+
+                if (type == RecordType::Chunk) {
+                    pinned = pinned || pin_all_chunks || live_chunks->contains({ id, current.value_pos });
+                    return;
+                }
+
+                if (type == RecordType::Put || type == RecordType::Blob) {
+                    if (_keydir->get(record.key) != current) {
+                        return;
+                    }
+
+                    // An expired value is dropped like a delete, leaving a tombstone only if an older file could resurrect the key.
+                    type = current.isExpired(now) ? RecordType::Tombstone : type;
+                }
+
+                if (type != RecordType::Tombstone) {
+                    // The record is copied as is, so its value lands at the same distance from the record start.
+                    KeyDirEntry next{ id, merged_size + record.valuePos() - record.pos, value_size, record.expires_at, current.is_blob };
+                    moved.emplace_back(record.key, current, next);
+                    storage::appendHintEntry(hints, { type, record.key, value_size, next.value_pos, record.expires_at });
+                }
+                else {
+                    if (record.type != RecordType::Tombstone) {
+                        _keydir->eraseIfExpired(record.key, now);
+                    }
+
+                    if (!keep_tombstones && !older_keys.contains(std::string{ record.key })) {
+                        return;
+                    }
+
+                    storage::appendHintEntry(hints, { RecordType::Tombstone, record.key, 0, merged_size });
+                }
+
+                auto record_start = pending.size();
+                if (type != RecordType::Tombstone) {
+                    storage::appendRecord(pending, type, record.key, record.value, record.expires_at);
+                }
+                else {
+                    storage::appendRecord(pending, type, record.key, {});
+                }
+                merged_size += pending.size() - record_start;
+                kept_keys.emplace_back(record.key);
+
+                if (pending.size() >= MERGE_WRITE_SIZE) {
+                    writePending();
+                }
+            });
+
+            writePending();
+
+            _storage->recordIo(IoCounter::MergeBytesRead, valid_size);
+            _storage->recordIo(IoCounter::MergeBytesWritten, merged_size);
+
+            if (write_error) {
+                return fail("writing", merge_file_path, write_error);
+            }
+
+            std::error_code ec{};
+            auto data_file_size = fs::file_size(data_file_path, ec);
+
+            if (ec || valid_size != data_file_size) {
+                storage::sharedLogger().log(storage::LogLevel::Warning, storage::LogEvent::Merge, "skipping {}: only {} of {} bytes are valid",
+                    data_file_path, valid_size, data_file_size);
+
+                // Leave damaged files untouched; their keys are unknown so every later tombstone must stay.
+                fs::remove(merge_file_path, ec);
+                keep_tombstones = true;
+                continue;
+            }
+
+            if (pinned) {
+                fs::remove(merge_file_path, ec);
+                older_keys.insert(std::make_move_iterator(scanned_keys.begin()), std::make_move_iterator(scanned_keys.end()));
+                continue;
+            }
+
+            // The merged file holds the only copy of its records once renamed, so they reach the disk first.
+            _storage->recordIo(IoCounter::Fsyncs, 1);
+            if (auto synced = merge_file->sync(); !synced) {
+                return fail("syncing", merge_file_path, synced.error());
+            }
+
+            // A hint that cannot be written is skipped; recovery then scans the data file instead.
+            auto hint_written = [&]() -> storage::Result<void> {
+                storage::sealHints(hints, merge_file->size());
+
+                auto hint_file = createFile(hint_tmp_path);
+                if (!hint_file) {
+                    return hint_file.error();
+                }
+
+                if (auto written = hint_file->write(hints.data(), static_cast<std::streamsize>(hints.size())); !written) {
+                    return written.error();
+                }
+
+                _storage->recordIo(IoCounter::Fsyncs, 1);
+                return hint_file->sync();
+            }();
+            _storage->recordIo(IoCounter::HintBytesWritten, hint_written ? hints.size() : 0);
+
+            // The hint of the previous layout must be gone for good before the new layout replaces it.
+            if (auto removed = _storage->removeHintFile(id); !removed) {
+                return fail("removing", hint_file_path, removed.error());
+            }
+            if (auto synced = _storage->syncDirectory(); !synced) {
+                return fail("syncing", _storage->getStorageDirectory().path(), synced.error());
+            }
+
+            // Readers overlapping the swap and the moves of its keys read again; see readConsistent.
+            _merge_epoch.fetch_add(1);
+
+            auto replaced = _storage->replaceDataFile(id, std::move(*merge_file));
+            if (replaced) {
+                for (const auto& [key, current, next] : moved) {
+                    _keydir->replaceIf(key, current, next);
+                }
+            }
+
+            _merge_epoch.fetch_add(1);
+
+            if (!replaced) {
+                return fail("replacing", data_file_path, replaced.error());
+            }
+
+            // The new data file is durable before a hint for it can be.
+            if (auto synced = _storage->syncDirectory(); !synced) {
+                return fail("syncing", _storage->getStorageDirectory().path(), synced.error());
+            }
+
+            if (hint_written) {
+                hint_written = _storage->installHintFile(id, hint_tmp_path, hints.size());
+            }
+
+            if (!hint_written) {
+                fs::remove(hint_tmp_path, ec);
+            }
+            else if (auto synced = _storage->syncDirectory(); !synced) {
+                return fail("syncing", _storage->getStorageDirectory().path(), synced.error());
+            }
+
+            older_keys.insert(std::make_move_iterator(kept_keys.begin()), std::make_move_iterator(kept_keys.end()));
+        }
+
+        _storage->recordLatency(storage::LatencyOp::Merge, start);
+
+        _merge_files_done = data_files.size();
+        _merges += 1;
+        _merge_running = false;
+
+        COSMO_PROBE1(merge_done, true);
+
+        return true;
+    }
+
+    size_t Cosmo::evictExpired(size_t max_batch) {
+        std::vector<TimerWheel::Timer> due{};
+        auto now = nowMillis();
+
+        _expiry_timers->advance(now, max_batch, due);
+
+        size_t evicted{};
+        for (const auto& timer : due) {
+            evicted += _keydir->eraseIfExpired(timer.key, now) ? 1 : 0;
+        }
+
+        return evicted;
+    }
+
+    size_t Cosmo::size() const {
+        return _keydir->size();
+    }
+
+    size_t Cosmo::scrub() {
+        return _scrubber->scrub();
+    }
+
+    ScrubStats Cosmo::scrubStats() const {
+        auto stats = _scrubber->stats();
+
+        return { stats.passes, stats.files_verified, stats.bytes_verified, stats.corrupt_ranges };
+    }
+
+    bool Cosmo::sync() {
+        return _storage->sync().has_value();
+    }
+
+    Stats Cosmo::getStats() const {
+        auto stats = _storage->getStats();
+
+        auto convert = [](const storage::LatencySummary& summary) {
+            return LatencyStats{ summary.count, summary.min, summary.mean, summary.p50, summary.p90, summary.p99, summary.p999, summary.max };
+        };
+
+        auto io = _storage->getIoStats();
+
+        Stats result{
+            convert(stats.read), convert(stats.write), convert(stats.flush), convert(stats.rollover), convert(stats.fsync), convert(stats.merge),
+            { io.user_bytes_written, io.data_bytes_written, io.merge_bytes_written, io.hint_bytes_written, io.merge_bytes_read, io.fsyncs,
+                io.disk_bytes, _keydir->liveBytes() },
+        };
+
+        auto buffer = _storage->getBufferFill();
+        result.gauges = {
+            _keydir->size(), _storage->getDataFiles().size(), buffer.used, buffer.capacity,
+            { _merges.load(), _merge_running.load(), _merge_files.load(), _merge_files_done.load() },
+        };
+
+        if constexpr (storage::LOCK_PROFILING) {
+            for (const auto& lock : storage::lockProfiler().stats()) {
+                result.locks.push_back({ std::string{ storage::LOCK_SITE_NAMES[static_cast<size_t>(lock.site)] }, lock.shared,
+                    lock.acquisitions, lock.contended, convert(lock.wait), convert(lock.hold) });
+            }
+        }
+
+        if constexpr (storage::PHASE_PROFILING) {
+            constexpr std::string_view operations[]{ "read", "write" };
+
+            for (const auto& thread : storage::phaseProfiler().stats()) {
+                for (size_t op = 0; op < storage::PHASE_OP_COUNT; ++op) {
+                    const auto& breakdown = thread.operations[op];
+                    if (breakdown.operations == 0) {
+                        continue;
+                    }
+
+                    const auto& phases = breakdown.phases;
+                    result.phases.push_back({ std::string{ operations[op] }, thread.thread, breakdown.operations, breakdown.total,
+                        phases[0], phases[1], phases[2], phases[3], phases[4], phases[5] });
+                }
+            }
+        }
+
+        return result;
+    }
+
+    std::string Cosmo::metrics() const {
+        auto stats = getStats();
+        auto scrub = _scrubber->stats();
+
+        std::string out{};
+        auto it = std::back_inserter(out);
+
+        auto family = [&it](std::string_view name, std::string_view type, std::string_view help) {
+            fmt::format_to(it, "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+        };
+        auto single = [&family, &it](std::string_view name, std::string_view type, std::string_view help, uint64_t value) {
+            family(name, type, help);
+            fmt::format_to(it, "{} {}\n", name, value);
+        };
+
+        // Buckets from 1us to 10s, three per decade.
+        constexpr std::string_view operations[]{ "read", "write", "flush", "rollover", "fsync", "merge" };
+        family("cosmo_operation_duration_seconds", "histogram", "Latency of storage operations.");
+
+        for (size_t op = 0; op < std::size(operations); ++op) {
+            auto histogram = _storage->getLatencies(static_cast<storage::LatencyOp>(op));
+
+            for (uint64_t decade = 1'000; decade <= 1'000'000'000; decade *= 10) {
+                for (uint64_t bound : { decade, decade * 5 / 2, decade * 5 }) {
+                    fmt::format_to(it, "cosmo_operation_duration_seconds_bucket{{operation=\"{}\",le=\"{}\"}} {}\n",
+                        operations[op], static_cast<double>(bound) / 1e9, histogram.countAtMost(bound));
+                }
+            }
+            fmt::format_to(it, "cosmo_operation_duration_seconds_bucket{{operation=\"{}\",le=\"10\"}} {}\n",
+                operations[op], histogram.countAtMost(10'000'000'000));
+            fmt::format_to(it, "cosmo_operation_duration_seconds_bucket{{operation=\"{}\",le=\"+Inf\"}} {}\n", operations[op], histogram.count());
+            fmt::format_to(it, "cosmo_operation_duration_seconds_sum{{operation=\"{}\"}} {}\n", operations[op], static_cast<double>(histogram.sum()) / 1e9);
+            fmt::format_to(it, "cosmo_operation_duration_seconds_count{{operation=\"{}\"}} {}\n", operations[op], histogram.count());
+        }
+
+        const auto& io = stats.io;
+        family("cosmo_written_bytes_total", "counter", "Bytes written by source: user payload, data file appends, merge output and hint files.");
+        fmt::format_to(it, "cosmo_written_bytes_total{{source=\"user\"}} {}\n", io.user_bytes_written);
+        fmt::format_to(it, "cosmo_written_bytes_total{{source=\"data\"}} {}\n", io.data_bytes_written);
+        fmt::format_to(it, "cosmo_written_bytes_total{{source=\"merge\"}} {}\n", io.merge_bytes_written);
+        fmt::format_to(it, "cosmo_written_bytes_total{{source=\"hint\"}} {}\n", io.hint_bytes_written);
+
+        single("cosmo_merge_read_bytes_total", "counter", "Bytes of data files read by merges.", io.merge_bytes_read);
+        single("cosmo_fsyncs_total", "counter", "File syncs issued.", io.fsyncs);
+        single("cosmo_disk_bytes", "gauge", "Size of the data, active and hint files.", io.disk_bytes);
+        single("cosmo_live_bytes", "gauge", "Key and value bytes the keydir points at.", io.live_bytes);
+        single("cosmo_dead_bytes", "gauge", "Disk bytes not referenced by the keydir, reclaimable by merge.", io.disk_bytes - std::min(io.disk_bytes, io.live_bytes));
+
+        const auto& gauges = stats.gauges;
+        single("cosmo_keys", "gauge", "Keys in the keydir, including expired keys not evicted yet.", gauges.keys);
+        single("cosmo_data_files", "gauge", "Immutable data files, not counting the active one.", gauges.data_files);
+        single("cosmo_write_buffer_bytes", "gauge", "Bytes waiting in the write buffer.", gauges.write_buffer_bytes);
+        single("cosmo_write_buffer_capacity_bytes", "gauge", "Size of the write buffer.", gauges.write_buffer_capacity);
+
+        single("cosmo_merges_total", "counter", "Merges completed.", gauges.merge.completed);
+        single("cosmo_merge_running", "gauge", "1 while a merge is running.", gauges.merge.running ? 1 : 0);
+        single("cosmo_merge_files", "gauge", "Data files of the current or last merge.", gauges.merge.files);
+        single("cosmo_merge_files_done", "gauge", "Data files the current or last merge has gone through.", gauges.merge.files_done);
+
+        auto memory = memoryUsage();
+        family("cosmo_memory_bytes", "gauge", "Estimated memory held by every instance in the process, by component.");
+        fmt::format_to(it, "cosmo_memory_bytes{{component=\"keydir\"}} {}\n", memory.keydir);
+        fmt::format_to(it, "cosmo_memory_bytes{{component=\"write_buffers\"}} {}\n", memory.write_buffers);
+        fmt::format_to(it, "cosmo_memory_bytes{{component=\"read_buffer\"}} {}\n", memory.read_buffer);
+        single("cosmo_memory_limit_bytes", "gauge", "Process-wide memory limit, 0 when there is none.", memory.limit);
+
+        single("cosmo_scrub_passes_total", "counter", "Scrub passes completed.", scrub.passes);
+        single("cosmo_scrub_verified_bytes_total", "counter", "Bytes whose checksums the scrubber verified.", scrub.bytes_verified);
+        single("cosmo_scrub_corrupt_ranges_total", "counter", "Corrupt ranges found by the scrubber.", scrub.corrupt_ranges);
+
+        return out;
+    }
+
+    uint16_t Cosmo::metricsPort() const {
+        return _metrics_server ? _metrics_server->port() : 0;
+    }
+
+    bool Cosmo::admitsKeys(std::span<const std::string_view> keys) const {
+        uint64_t memory{};
+        for (auto key : keys) {
+            memory += storage::KeyDir::entryMemory(key);
+        }
+
+        if (storage::memoryBudget().admits(memory)) {
+            return true;
+        }
+
+        // Overwrites do not grow the keydir, so they stay possible at the limit.
+        auto known = std::ranges::all_of(keys, [this](std::string_view key) { return _keydir->get(key).has_value(); });
+        if (!known) {
+            storage::sharedLogger().log(storage::LogLevel::Warning, storage::LogEvent::Memory,
+                "refusing new keys: the keydir would exceed the memory limit of {} bytes", storage::memoryBudget().limit());
+        }
+
+        return known;
+    }
+
+    void Cosmo::loadKeyDir() {
+        auto now = nowMillis();
+
+        auto apply = [this, now](RecordType type, std::string_view key, const KeyDirEntry& entry) {
+            if (type == RecordType::Chunk) {
+                return;
+            }
+
+            if (type == RecordType::Tombstone || entry.isExpired(now)) {
+                _keydir->erase(key);
+            }
+            else {
+                _keydir->put(key, entry);
+            }
+        };
+
+        auto scanDataFile = [&apply](const fs::path& path, data_file_id_t id) {
+            return storage::scanRecords(path, [&apply, id](const RecordView& record) {
+                apply(record.type, record.key, { id, record.valuePos(), record.value.size(), record.expires_at, record.type == RecordType::Blob });
+            });
+        };
+
+        auto data_files = _storage->getDataFiles();
+
+        for (data_file_id_t id = 0; id < data_files.size(); ++id) {
+            auto hinted = storage::scanHints(_storage->getHintFilePath(id), data_files.at(id).size(), [&apply, id](const HintEntry& hint) {
+                apply(hint.type, hint.key, { id, hint.value_pos, hint.value_size, hint.expires_at, hint.type == RecordType::Blob });
+            });
+
+            if (!hinted) {
+                scanDataFile(data_files.at(id).getPath(), id);
+            }
+        }
+
+        // A crash can leave a torn record at the end of the active file. It is cut off so new
+        // writes do not land behind bytes that recovery would stop at.
+        auto valid_size = scanDataFile(_storage->getActiveFilePath(), _storage->getActiveFileId());
+        if (valid_size < _storage->getActiveFileSize()) {
+            storage::sharedLogger().log(storage::LogLevel::Warning, storage::LogEvent::Recovery, "truncating torn tail of {} from {} to {} bytes",
+                _storage->getActiveFilePath(), _storage->getActiveFileSize(), valid_size);
+
+            if (!_storage->truncateActiveFile(valid_size)) {
+                throw std::runtime_error("Unable to truncate the torn tail of the active file");
+            }
+        }
+
+        _keydir->forEach([this](std::string_view key, const KeyDirEntry& entry) {
+            if (entry.expires_at) {
+                _expiry_timers->schedule(std::string{ key }, entry.expires_at);
+            }
+        });
+    }
+}
@@ -0,0 +1,197 @@
+#include "metrics_server.hpp"
+
+#include "log/logger.hpp"
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <string_view>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace cosmo::storage {
+    namespace {
+#ifdef _WIN32
+        using socket_t = SOCKET;
+
+        void closeSocket(socket_t socket) { ::closesocket(socket); }
+
+        std::error_code lastSocketError() { return { ::WSAGetLastError(), std::system_category() }; }
+
+        int pollSocket(pollfd* fd, int timeout) { return ::WSAPoll(fd, 1, timeout); }
+#else
+        using socket_t = int;
+
+        void closeSocket(socket_t socket) { ::close(socket); }
+
+        std::error_code lastSocketError() { return { errno, std::generic_category() }; }
+
+        int pollSocket(pollfd* fd, int timeout) { return ::poll(fd, 1, timeout); }
+#endif
+
+        // How often the listener checks for stop() while idle.
+        constexpr int POLL_INTERVAL_MS{ 100 };
+        constexpr size_t MAX_REQUEST_SIZE{ 8 * 1024 };
+
+        // A client hanging up mid-response must not raise SIGPIPE in the host process.
+#ifdef MSG_NOSIGNAL
+        constexpr int SEND_FLAGS{ MSG_NOSIGNAL };
+#else
+        constexpr int SEND_FLAGS{ 0 };
+#endif
+
+        bool sendAll(socket_t socket, std::string_view data) {
+            while (!data.empty()) {
+                auto sent = ::send(socket, data.data(), static_cast<int>(data.size()), SEND_FLAGS);
+                if (sent <= 0) {
+                    return false;
+                }
+                data.remove_prefix(static_cast<size_t>(sent));
+            }
+            return true;
+        }
+
+        std::string response(std::string_view status, std::string_view content_type, std::string_view body) {
+            return fmt::format("HTTP/1.1 {}\r\nContent-Type: {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+                status, content_type, body.size(), body);
+        }
+    }
+
+    MetricsServer::MetricsServer(Renderer render) : _render{ std::move(render) } {}
+
+    MetricsServer::~MetricsServer() {
+        stop();
+    }
+
+    Result<void> MetricsServer::start(uint16_t port) {
+        std::scoped_lock lck{ _mtx };
+
+        if (_worker.joinable()) {
+            return {};
+        }
+
+#ifdef _WIN32
+        WSADATA wsa{};
+        if (auto status = ::WSAStartup(MAKEWORD(2, 2), &wsa); status != 0) {
+            return std::error_code{ status, std::system_category() };
+        }
+#endif
+
+        auto listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == static_cast<socket_t>(-1)) {
+            return lastSocketError();
+        }
+
+        int reuse{ 1 };
+        ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+
+        socklen_t address_size{ sizeof(address) };
+        if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, 16) != 0 ||
+            ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_size) != 0) {
+            auto error = lastSocketError();
+            closeSocket(listener);
+            return error;
+        }
+
+        _listener = static_cast<intptr_t>(listener);
+        _port = ntohs(address.sin_port);
+        _stopping = false;
+        _worker = std::thread{ [this] { serve(); } };
+
+        sharedLogger().log(LogLevel::Info, LogEvent::Admin, "serving metrics on http://127.0.0.1:{}/metrics", _port);
+
+        return {};
+    }
+
+    void MetricsServer::stop() {
+        std::scoped_lock lck{ _mtx };
+
+        if (!_worker.joinable()) {
+            return;
+        }
+
+        _stopping = true;
+        _worker.join();
+
+        closeSocket(static_cast<socket_t>(_listener));
+        _listener = -1;
+        _port = 0;
+
+#ifdef _WIN32
+        ::WSACleanup();
+#endif
+    }
+
+    void MetricsServer::serve() {
+        auto listener = static_cast<socket_t>(_listener);
+
+        while (!_stopping.load()) {
+            pollfd fd{ listener, POLLIN, 0 };
+            if (pollSocket(&fd, POLL_INTERVAL_MS) <= 0) {
+                continue;
+            }
+
+            auto connection = ::accept(listener, nullptr, nullptr);
+            if (connection == static_cast<socket_t>(-1)) {
+                continue;
+            }
+
+            handle(static_cast<intptr_t>(connection));
+            closeSocket(connection);
+        }
+    }
+
+    void MetricsServer::handle(intptr_t connection) {
+        auto socket = static_cast<socket_t>(connection);
+
+        // A client that never finishes its request must not hold the listener forever.
+#ifdef _WIN32
+        DWORD timeout{ 1'000 };
+#else
+        timeval timeout{ 1, 0 };
+#endif
+        ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+        std::string request{};
+        char chunk[1'024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE) {
+            auto received = ::recv(socket, chunk, static_cast<int>(sizeof(chunk)), 0);
+            if (received <= 0) {
+                break;
+            }
+            request.append(chunk, static_cast<size_t>(received));
+        }
+
+        std::string_view line{ request };
+        line = line.substr(0, line.find("\r\n"));
+
+        if (line.starts_with("GET /metrics ") || line.starts_with("GET /metrics?")) {
+            sendAll(socket, response("200 OK", "text/plain; version=0.0.4; charset=utf-8", _render()));
+        }
+        else if (line.starts_with("GET ")) {
+            sendAll(socket, response("404 Not Found", "text/plain; charset=utf-8", "not found\n"));
+        }
+        else {
+            sendAll(socket, response("405 Method Not Allowed", "text/plain; charset=utf-8", "only GET is supported\n"));
+        }
+    }
+}
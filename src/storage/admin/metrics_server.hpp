@@ -0,0 +1,47 @@
+#pragma once
+
+#include <storage_utils.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cosmo::storage {
+    // Minimal HTTP listener on 127.0.0.1 that answers GET /metrics with whatever render returns,
+    // one connection at a time on its own thread. render runs on that thread and must not block
+    // on the data path.
+    class MetricsServer {
+    public:
+        using Renderer = std::function<std::string()>;
+
+        explicit MetricsServer(Renderer render);
+        ~MetricsServer();
+
+        MetricsServer(const MetricsServer&) = delete;
+        MetricsServer& operator=(const MetricsServer&) = delete;
+
+        // Binds the port, 0 for any free one, and starts serving.
+        Result<void> start(uint16_t port);
+
+        void stop();
+
+        // The bound port, 0 while not serving.
+        uint16_t port() const { return _port; }
+
+    private:
+        void serve();
+
+        void handle(intptr_t connection);
+
+        Renderer _render{};
+
+        std::mutex _mtx;
+        std::atomic<bool> _stopping{};
+        intptr_t _listener{ -1 };
+        uint16_t _port{};
+        std::thread _worker{};
+    };
+}
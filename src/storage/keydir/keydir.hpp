@@ -0,0 +1,180 @@
+#pragma once
+
+#include <storage_utils.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cosmo::storage {
+    struct KeyDirEntry {
+        data_file_id_t file_id{};
+        offset_t value_pos{};
+        data_file_size_t value_size{};
+        uint64_t expires_at{};
+        bool is_blob{};
+
+        bool isExpired(uint64_t now) const { return expires_at != 0 && expires_at <= now; }
+
+        bool operator==(const KeyDirEntry&) const = default;
+    };
+
+    class KeyDir {
+    public:
+        KeyDir() = default;
+
+        KeyDir(const KeyDir&) = delete;
+        KeyDir& operator=(const KeyDir&) = delete;
+
+        ~KeyDir() {
+            memoryBudget().release(MemoryComponent::KeyDir, _memory);
+        }
+
+        // Estimated heap bytes of one entry: the hash node, its bucket and the key unless it is
+        // stored inline.
+        static uint64_t entryMemory(std::string_view key) {
+            constexpr size_t INLINE_KEY_SIZE{ 15 };
+            return sizeof(Entries::value_type) + 3 * sizeof(void*) + (key.size() > INLINE_KEY_SIZE ? key.size() + 1 : 0);
+        }
+
+        std::optional<KeyDirEntry> get(std::string_view key) const {
+            std::shared_lock lck{ _mtx };
+
+            auto it = _entries.find(key);
+            if (it == _entries.end()) {
+                return std::nullopt;
+            }
+
+            return it->second;
+        }
+
+        void put(std::string_view key, const KeyDirEntry& entry) {
+            std::unique_lock lck{ _mtx };
+
+            assign(key, entry);
+        }
+
+        bool erase(std::string_view key) {
+            std::unique_lock lck{ _mtx };
+
+            auto it = _entries.find(key);
+            if (it == _entries.end()) {
+                return false;
+            }
+
+            remove(it);
+            return true;
+        }
+
+        bool eraseIfExpired(std::string_view key, uint64_t now) {
+            std::unique_lock lck{ _mtx };
+
+            auto it = _entries.find(key);
+            if (it == _entries.end() || !it->second.isExpired(now)) {
+                return false;
+            }
+
+            remove(it);
+            return true;
+        }
+
+        // Applies every update under a single lock acquisition; an empty entry erases the key.
+        void publish(const std::vector<std::pair<std::string_view, std::optional<KeyDirEntry>>>& updates) {
+            std::unique_lock lck{ _mtx };
+
+            for (const auto& [key, entry] : updates) {
+                if (entry) {
+                    assign(key, *entry);
+                }
+                else if (auto it = _entries.find(key); it != _entries.end()) {
+                    remove(it);
+                }
+            }
+        }
+
+        // Used by merge: only moves an entry if nothing newer was published for the key meanwhile.
+        bool replaceIf(std::string_view key, const KeyDirEntry& expected, const KeyDirEntry& desired) {
+            std::unique_lock lck{ _mtx };
+
+            auto it = _entries.find(key);
+            if (it == _entries.end() || it->second != expected) {
+                return false;
+            }
+
+            _live_bytes += desired.value_size - it->second.value_size;
+            it->second = desired;
+            return true;
+        }
+
+        template <typename Visitor>
+        void forEach(Visitor&& visitor) const {
+            std::shared_lock lck{ _mtx };
+
+            for (const auto& [key, entry] : _entries) {
+                visitor(key, entry);
+            }
+        }
+
+        // Read without the keydir lock, so monitoring never waits on writers.
+        size_t size() const {
+            return _size.load(std::memory_order_relaxed);
+        }
+
+        // Key and value bytes of the records the keydir points at. Chunks of streamed values
+        // are not included, only their manifests.
+        uint64_t liveBytes() const {
+            return _live_bytes.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct KeyHash {
+            using is_transparent = void;
+
+            size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+        };
+
+        using Entries = std::unordered_map<std::string, KeyDirEntry, KeyHash, std::equal_to<>>;
+
+        mutable std::shared_mutex _mtx;
+        Entries _entries{};
+        // Mirrors of the map kept under the lock and readable without it.
+        std::atomic<size_t> _size{};
+        std::atomic<uint64_t> _live_bytes{};
+        // Charged to the memory budget for the entries; entries must stay in memory, so this is never refused.
+        uint64_t _memory{};
+
+        void assign(std::string_view key, const KeyDirEntry& entry) {
+            auto it = _entries.find(key);
+            if (it == _entries.end()) {
+                _entries.emplace(std::string{ key }, entry);
+                _size.store(_entries.size(), std::memory_order_relaxed);
+
+                auto memory = entryMemory(key);
+                memoryBudget().reserve(MemoryComponent::KeyDir, memory);
+                _memory += memory;
+                _live_bytes += key.size() + entry.value_size;
+            }
+            else {
+                _live_bytes += entry.value_size - it->second.value_size;
+                it->second = entry;
+            }
+        }
+
+        void remove(Entries::iterator it) {
+            _live_bytes -= it->first.size() + it->second.value_size;
+
+            auto memory = entryMemory(it->first);
+            memoryBudget().release(MemoryComponent::KeyDir, memory);
+            _memory -= memory;
+
+            _entries.erase(it);
+            _size.store(_entries.size(), std::memory_order_relaxed);
+        }
+    };
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cosmo::storage {
+    // Hierarchical timing wheel tracking key expiry deadlines. Deadlines are bucketed
+    // by tick on the lowest level able to hold them and cascade down as time advances,
+    // so scheduling is O(1) and draining only touches the buckets that came due.
+    class TimerWheel {
+    public:
+        struct Timer {
+            std::string key{};
+            uint64_t expires_at{};
+        };
+
+        explicit TimerWheel(uint64_t now, uint64_t tick = DEFAULT_TICK) :
+            _tick{ tick }, _current_tick{ now / tick } {}
+
+        void schedule(std::string key, uint64_t expires_at) {
+            std::scoped_lock lck{ _mtx };
+
+            insert({ std::move(key), expires_at });
+        }
+
+        // Moves at most max_batch timers whose deadline is due at now into due. Timers
+        // beyond the batch stay queued for the next call.
+        size_t advance(uint64_t now, size_t max_batch, std::vector<Timer>& due) {
+            std::scoped_lock lck{ _mtx };
+
+            auto target_tick = now / _tick;
+
+            while (_ready.size() < max_batch && _current_tick < target_tick) {
+                ++_current_tick;
+
+                for (size_t level = 1; level < LEVELS && slotIndex(_current_tick, level - 1) == 0; ++level) {
+                    cascade(level);
+                }
+
+                auto& slot = _wheels[0][slotIndex(_current_tick, 0)];
+                for (auto& timer : slot) {
+                    _ready.emplace_back(std::move(timer));
+                }
+                slot.clear();
+            }
+
+            size_t moved{};
+            while (moved < max_batch && !_ready.empty()) {
+                due.emplace_back(std::move(_ready.back()));
+                _ready.pop_back();
+                ++moved;
+            }
+
+            return moved;
+        }
+
+        size_t size() const {
+            std::scoped_lock lck{ _mtx };
+
+            size_t count = _ready.size();
+            for (const auto& wheel : _wheels) {
+                for (const auto& slot : wheel) {
+                    count += slot.size();
+                }
+            }
+            return count;
+        }
+
+        static constexpr uint64_t DEFAULT_TICK{ 1'000 };
+
+    private:
+        static constexpr size_t SLOT_BITS{ 6 };
+        static constexpr size_t SLOTS{ size_t{ 1 } << SLOT_BITS };
+        static constexpr size_t LEVELS{ 4 };
+
+        mutable std::mutex _mtx;
+        uint64_t _tick{};
+        uint64_t _current_tick{};
+        std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> _wheels{};
+        std::vector<Timer> _ready{};
+
+        static size_t slotIndex(uint64_t tick, size_t level) {
+            return static_cast<size_t>((tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+        }
+
+        void insert(Timer timer) {
+            auto tick = timer.expires_at / _tick;
+
+            if (tick <= _current_tick) {
+                _ready.emplace_back(std::move(timer));
+                return;
+            }
+
+            auto delta = tick - _current_tick;
+
+            for (size_t level = 0; level < LEVELS; ++level) {
+                if (delta < (uint64_t{ 1 } << (SLOT_BITS * (level + 1)))) {
+                    _wheels[level][slotIndex(tick, level)].emplace_back(std::move(timer));
+                    return;
+                }
+            }
+
+            // Deadlines past the wheel horizon park in the farthest slot and get re-inserted when it cascades.
+            auto farthest = _current_tick + (uint64_t{ 1 } << (SLOT_BITS * LEVELS)) - 1;
+            _wheels[LEVELS - 1][slotIndex(farthest, LEVELS - 1)].emplace_back(std::move(timer));
+        }
+
+        void cascade(size_t level) {
+            auto timers = std::move(_wheels[level][slotIndex(_current_tick, level)]);
+            _wheels[level][slotIndex(_current_tick, level)].clear();
+
+            for (auto& timer : timers) {
+                insert(std::move(timer));
+            }
+        }
+    };
+}
@@ -0,0 +1,171 @@
+#include "logger.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <string>
+
+namespace cosmo::storage {
+    namespace {
+        std::string_view levelName(LogLevel level) {
+            switch (level) {
+            case LogLevel::Debug:
+                return "debug";
+            case LogLevel::Info:
+                return "info";
+            case LogLevel::Warning:
+                return "warning";
+            default:
+                return "error";
+            }
+        }
+
+        void writeToStderr(LogLevel, std::string_view line) {
+            std::fwrite(line.data(), 1, line.size(), stderr);
+            std::fputc('\n', stderr);
+            std::fflush(stderr);
+        }
+    }
+
+    Logger::Logger() :
+        _slots{ std::make_unique<Slot[]>(QUEUE_CAPACITY) }, _sink{ writeToStderr } {
+        for (size_t i = 0; i < QUEUE_CAPACITY; ++i) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        _writer = std::thread{ [this] { run(); } };
+    }
+
+    Logger::~Logger() {
+        _stopping.store(true, std::memory_order_release);
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+
+        if (_writer.joinable()) {
+            _writer.join();
+        }
+    }
+
+    void Logger::setSink(Sink sink) {
+        std::scoped_lock lck{ _sink_mtx };
+
+        _sink = sink ? std::move(sink) : Sink{ writeToStderr };
+    }
+
+    void Logger::flush() {
+        auto target = _enqueue_pos.load(std::memory_order_acquire);
+
+        for (auto written = _written.load(std::memory_order_acquire); written < target; written = _written.load(std::memory_order_acquire)) {
+            _written.wait(written, std::memory_order_acquire);
+        }
+    }
+
+    bool Logger::admit(LogEvent event, uint64_t& suppressed) {
+        auto& budget = _budgets[static_cast<size_t>(event) % EVENT_COUNT];
+
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        auto window = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+
+        // The first caller of a new one-second window resets the budget and reports what the last one swallowed.
+        auto current = budget.window.load(std::memory_order_relaxed);
+        if (current != window && budget.window.compare_exchange_strong(current, window, std::memory_order_relaxed)) {
+            budget.count.store(0, std::memory_order_relaxed);
+            suppressed = budget.suppressed.exchange(0, std::memory_order_relaxed);
+        }
+
+        if (budget.count.fetch_add(1, std::memory_order_relaxed) < _rate_limit.load(std::memory_order_relaxed)) {
+            return true;
+        }
+
+        budget.suppressed.fetch_add(1 + suppressed, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Bounded MPMC queue after Dmitry Vyukov: a slot is free for position pos while its
+    // sequence equals pos, and holds a message for the reader while it equals pos + 1.
+    Logger::Slot* Logger::acquire(size_t& pos) {
+        pos = _enqueue_pos.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto* slot = &_slots[pos & (QUEUE_CAPACITY - 1)];
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return slot;
+                }
+            }
+            else if (diff < 0) {
+                return nullptr;
+            }
+            else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Logger::publish(Slot* slot, size_t pos) {
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        _signal.fetch_add(1);
+        if (_sleeping.load()) {
+            _signal.notify_one();
+        }
+    }
+
+    void Logger::run() {
+        while (true) {
+            auto signal = _signal.load(std::memory_order_acquire);
+
+            if (drain() == 0) {
+                if (_stopping.load(std::memory_order_acquire)) {
+                    return;
+                }
+
+                // Either a publisher sees the flag and notifies, or this sees its signal and skips the wait.
+                _sleeping.store(true);
+                if (_signal.load() == signal) {
+                    _signal.wait(signal, std::memory_order_acquire);
+                }
+                _sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t Logger::drain() {
+        std::string line{};
+        size_t count{};
+
+        while (true) {
+            auto* slot = &_slots[_dequeue_pos & (QUEUE_CAPACITY - 1)];
+            if (slot->sequence.load(std::memory_order_acquire) != _dequeue_pos + 1) {
+                break;
+            }
+
+            line.clear();
+            fmt::format_to(std::back_inserter(line), "cosmo {}: {}", levelName(slot->level), std::string_view{ slot->text.data(), slot->size });
+            if (slot->suppressed > 0) {
+                fmt::format_to(std::back_inserter(line), " ({} similar messages suppressed)", slot->suppressed);
+            }
+            auto level = slot->level;
+
+            slot->sequence.store(_dequeue_pos + QUEUE_CAPACITY, std::memory_order_release);
+            ++_dequeue_pos;
+
+            {
+                std::scoped_lock lck{ _sink_mtx };
+                _sink(level, line);
+            }
+
+            _written.fetch_add(1, std::memory_order_release);
+            ++count;
+        }
+
+        if (count > 0) {
+            _written.notify_all();
+        }
+
+        return count;
+    }
+}
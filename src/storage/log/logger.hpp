@@ -0,0 +1,159 @@
+#pragma once
+
+#include <fmt/format.h>
+#include <fmt/std.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace cosmo::storage {
+    enum class LogLevel : uint8_t {
+        Debug = 0,
+        Info = 1,
+        Warning = 2,
+        Error = 3,
+        Off = 4,
+    };
+
+    // Each kind of message has its own rate limit, so a storm of one cannot hide the others.
+    enum class LogEvent : uint8_t {
+        ReadFailed = 0,
+        WriteFailed = 1,
+        FlushFailed = 2,
+        Recovery = 3,
+        Merge = 4,
+        Scrub = 5,
+        Admin = 6,
+        Memory = 7,
+    };
+
+    // Engine log. Callers format into a preallocated slot of a bounded lock-free queue and a
+    // background thread hands the lines to the sink, so logging from an I/O path never takes a
+    // lock or waits on the sink. The writer is only woken, which can cost a syscall, when it is
+    // asleep. Arguments that format through a temporary, such as ErrorText and paths, still
+    // allocate. Messages beyond the rate limit of their event, or arriving while the queue is
+    // full, are counted and dropped rather than waited on.
+    class Logger {
+    public:
+        using Sink = std::function<void(LogLevel, std::string_view)>;
+
+        Logger();
+        ~Logger();
+
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+
+        bool enabled(LogLevel level) const { return level >= _level.load(std::memory_order_relaxed); }
+
+        template <typename... Args>
+        void log(LogLevel level, LogEvent event, fmt::format_string<Args...> format, Args&&... args) {
+            if (!enabled(level)) {
+                return;
+            }
+
+            uint64_t suppressed{};
+            if (!admit(event, suppressed)) {
+                return;
+            }
+
+            size_t pos{};
+            auto* slot = acquire(pos);
+            if (!slot) {
+                _dropped.fetch_add(1 + suppressed, std::memory_order_relaxed);
+                return;
+            }
+
+            auto result = fmt::format_to_n(slot->text.data(), slot->text.size(), format, std::forward<Args>(args)...);
+            slot->size = std::min(result.size, slot->text.size());
+            slot->level = level;
+            slot->suppressed = suppressed;
+
+            publish(slot, pos);
+        }
+
+        void setLevel(LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+
+        // Messages per second and per event; the surplus is summarized on the next message let through.
+        void setRateLimit(uint32_t messages_per_second) { _rate_limit.store(messages_per_second, std::memory_order_relaxed); }
+
+        // Replaces the default stderr sink. The sink only ever runs on the writer thread.
+        void setSink(Sink sink);
+
+        // Blocks until every message queued before the call reached the sink.
+        void flush();
+
+        uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+        static constexpr size_t QUEUE_CAPACITY{ 1024 };
+        static constexpr size_t MESSAGE_SIZE{ 256 };
+        static constexpr uint32_t DEFAULT_RATE_LIMIT{ 20 };
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence{};
+            LogLevel level{};
+            uint64_t suppressed{};
+            size_t size{};
+            std::array<char, MESSAGE_SIZE> text{};
+        };
+
+        struct Budget {
+            std::atomic<uint64_t> window{};
+            std::atomic<uint32_t> count{};
+            std::atomic<uint64_t> suppressed{};
+        };
+
+        static constexpr size_t EVENT_COUNT{ 8 };
+
+        bool admit(LogEvent event, uint64_t& suppressed);
+        Slot* acquire(size_t& pos);
+        void publish(Slot* slot, size_t pos);
+        void run();
+        size_t drain();
+
+        std::unique_ptr<Slot[]> _slots;
+        alignas(64) std::atomic<size_t> _enqueue_pos{};
+        alignas(64) size_t _dequeue_pos{};
+        std::atomic<uint64_t> _signal{};
+        // Set while the writer waits on _signal, so publishers only notify when it is needed.
+        std::atomic<bool> _sleeping{};
+        std::atomic<size_t> _written{};
+
+        std::atomic<LogLevel> _level{ LogLevel::Warning };
+        std::atomic<uint32_t> _rate_limit{ DEFAULT_RATE_LIMIT };
+        std::array<Budget, EVENT_COUNT> _budgets{};
+        std::atomic<uint64_t> _dropped{};
+
+        std::mutex _sink_mtx;
+        Sink _sink{};
+
+        std::atomic<bool> _stopping{};
+        std::thread _writer{};
+    };
+
+    inline Logger& sharedLogger() {
+        static Logger logger{};
+        return logger;
+    }
+
+    // Formats as the error's message. Building it allocates, but only for messages that get through.
+    struct ErrorText {
+        std::error_code error{};
+    };
+}
+
+template <>
+struct fmt::formatter<cosmo::storage::ErrorText> : fmt::formatter<std::string_view> {
+    auto format(const cosmo::storage::ErrorText& text, fmt::format_context& ctx) const {
+        return fmt::formatter<std::string_view>::format(text.error.message(), ctx);
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace cosmo::storage {
+    enum class MemoryComponent : uint8_t {
+        KeyDir = 0,
+        WriteBuffer = 1,
+        ReadBuffer = 2,
+    };
+
+    inline constexpr size_t MEMORY_COMPONENT_COUNT{ 3 };
+
+    // Bytes held by each component of every engine instance in the process, against one optional
+    // limit. Memory that must exist anyway, such as keydir entries being loaded, is charged with
+    // reserve(); memory a component can do without, such as growing a buffer, asks tryReserve()
+    // first. Above PRESSURE_PERCENT of the limit, components give back what they can spare.
+    class MemoryBudget {
+    public:
+        static constexpr uint64_t PRESSURE_PERCENT{ 90 };
+
+        // 0 removes the limit.
+        void setLimit(uint64_t bytes) {
+            _limit.store(bytes, std::memory_order_relaxed);
+        }
+
+        uint64_t limit() const {
+            return _limit.load(std::memory_order_relaxed);
+        }
+
+        void reserve(MemoryComponent component, uint64_t bytes) {
+            _used[static_cast<size_t>(component)].value.fetch_add(bytes, std::memory_order_relaxed);
+            _total.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        // Charges bytes only if they fit under the limit.
+        bool tryReserve(MemoryComponent component, uint64_t bytes) {
+            auto limit = this->limit();
+            auto total = _total.load(std::memory_order_relaxed);
+
+            do {
+                if (limit != 0 && total + bytes > limit) {
+                    return false;
+                }
+            } while (!_total.compare_exchange_weak(total, total + bytes, std::memory_order_relaxed));
+
+            _used[static_cast<size_t>(component)].value.fetch_add(bytes, std::memory_order_relaxed);
+            return true;
+        }
+
+        void release(MemoryComponent component, uint64_t bytes) {
+            _used[static_cast<size_t>(component)].value.fetch_sub(bytes, std::memory_order_relaxed);
+            _total.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        // Whether bytes more would still fit, without charging them.
+        bool admits(uint64_t bytes) const {
+            auto limit = this->limit();
+            return limit == 0 || used() + bytes <= limit;
+        }
+
+        bool underPressure() const {
+            auto limit = this->limit();
+            return limit != 0 && used() * 100 >= limit * PRESSURE_PERCENT;
+        }
+
+        uint64_t used() const {
+            return _total.load(std::memory_order_relaxed);
+        }
+
+        uint64_t used(MemoryComponent component) const {
+            return _used[static_cast<size_t>(component)].value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct alignas(64) Counter {
+            std::atomic<uint64_t> value{};
+        };
+
+        std::atomic<uint64_t> _limit{};
+        alignas(64) std::atomic<uint64_t> _total{};
+        std::array<Counter, MEMORY_COMPONENT_COUNT> _used{};
+    };
+
+    inline MemoryBudget& memoryBudget() {
+        static MemoryBudget budget{};
+        return budget;
+    }
+}
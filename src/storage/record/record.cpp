@@ -0,0 +1,509 @@
+#include "record.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define COSMO_CRC32C_X86 1
+#define COSMO_CRC32C_TARGET __attribute__((target("sse4.2")))
+#elif defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define COSMO_CRC32C_X86 1
+#define COSMO_CRC32C_TARGET
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define COSMO_CRC32C_ARM 1
+#endif
+
+namespace cosmo::storage {
+    namespace {
+        constexpr uint32_t CRC32C_POLYNOMIAL{ 0x82F63B78 };
+
+        // Slicing-by-8 tables: CRC_TABLES[k][b] is the CRC of byte b followed by k zero bytes.
+        constexpr std::array<std::array<uint32_t, 256>, 8> makeCrcTables() {
+            std::array<std::array<uint32_t, 256>, 8> tables{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (auto bit = 0; bit < 8; ++bit) {
+                    crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+                }
+                tables[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (size_t k = 1; k < tables.size(); ++k) {
+                    tables[k][i] = tables[0][tables[k - 1][i] & 0xFF] ^ (tables[k - 1][i] >> 8);
+                }
+            }
+            return tables;
+        }
+
+        constexpr auto CRC_TABLES = makeCrcTables();
+
+        uint32_t crc32cPortable(const char* data, size_t size, uint32_t crc) {
+            if constexpr (std::endian::native == std::endian::little) {
+                for (; size >= 8; data += 8, size -= 8) {
+                    uint32_t low;
+                    uint32_t high;
+                    std::memcpy(&low, data, sizeof(low));
+                    std::memcpy(&high, data + 4, sizeof(high));
+                    low ^= crc;
+
+                    crc = CRC_TABLES[7][low & 0xFF] ^ CRC_TABLES[6][(low >> 8) & 0xFF]
+                        ^ CRC_TABLES[5][(low >> 16) & 0xFF] ^ CRC_TABLES[4][low >> 24]
+                        ^ CRC_TABLES[3][high & 0xFF] ^ CRC_TABLES[2][(high >> 8) & 0xFF]
+                        ^ CRC_TABLES[1][(high >> 16) & 0xFF] ^ CRC_TABLES[0][high >> 24];
+                }
+            }
+
+            for (; size > 0; ++data, --size) {
+                crc = CRC_TABLES[0][(crc ^ static_cast<uint8_t>(*data)) & 0xFF] ^ (crc >> 8);
+            }
+
+            return crc;
+        }
+
+#if COSMO_CRC32C_X86
+        COSMO_CRC32C_TARGET uint32_t crc32cHardware(const char* data, size_t size, uint32_t crc) {
+            uint64_t crc64 = crc;
+            for (; size >= 8; data += 8, size -= 8) {
+                uint64_t word;
+                std::memcpy(&word, data, sizeof(word));
+                crc64 = _mm_crc32_u64(crc64, word);
+            }
+
+            crc = static_cast<uint32_t>(crc64);
+            for (; size > 0; ++data, --size) {
+                crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+            }
+
+            return crc;
+        }
+
+        bool hasHardwareCrc() {
+#if defined(_MSC_VER)
+            int info[4]{};
+            __cpuid(info, 1);
+            return (info[2] & (1 << 20)) != 0;
+#else
+            return __builtin_cpu_supports("sse4.2");
+#endif
+        }
+#elif COSMO_CRC32C_ARM
+        uint32_t crc32cHardware(const char* data, size_t size, uint32_t crc) {
+            for (; size >= 8; data += 8, size -= 8) {
+                uint64_t word;
+                std::memcpy(&word, data, sizeof(word));
+                crc = __crc32cd(crc, word);
+            }
+
+            for (; size > 0; ++data, --size) {
+                crc = __crc32cb(crc, static_cast<uint8_t>(*data));
+            }
+
+            return crc;
+        }
+
+        bool hasHardwareCrc() {
+            return true;
+        }
+#endif
+
+        using CrcFunction = uint32_t (*)(const char*, size_t, uint32_t);
+
+        // Picked once: SSE4.2 or ARMv8 CRC instructions when the CPU has them, slicing-by-8 otherwise.
+        CrcFunction selectCrc32c() {
+#if COSMO_CRC32C_X86 || COSMO_CRC32C_ARM
+            if (hasHardwareCrc()) {
+                return crc32cHardware;
+            }
+#endif
+            return crc32cPortable;
+        }
+
+        template <typename T>
+        void putFixed(std::string& out, T value) {
+            char bytes[sizeof(T)];
+            std::memcpy(bytes, &value, sizeof(T));
+            out.append(bytes, sizeof(T));
+        }
+
+        template <typename T>
+        T getFixed(const char* in) {
+            T value;
+            std::memcpy(&value, in, sizeof(T));
+            return value;
+        }
+
+        // A non-zero width pads the encoding with continuation bytes, which decoders read as the same value.
+        void putVarint(std::string& out, uint64_t value, size_t width = 0) {
+            for (size_t written = 1; value >= 0x80 || written < width; ++written) {
+                out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        bool getVarint(const char*& in, const char* end, uint64_t& value) {
+            value = 0;
+            for (size_t shift = 0; shift < 64 && in < end; shift += 7) {
+                auto byte = static_cast<uint8_t>(*in++);
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool parseHeader(std::string_view in, RecordHeader& header, size_t& header_size) {
+            if (in.size() < RecordHeader::FIXED_SIZE) {
+                return false;
+            }
+
+            const auto* cursor = in.data() + RecordHeader::FIXED_SIZE;
+            const auto* end = in.data() + in.size();
+
+            header.crc = getFixed<uint32_t>(in.data());
+            header.type = static_cast<RecordType>(getFixed<uint8_t>(in.data() + sizeof(uint32_t)));
+
+            if (!getVarint(cursor, end, header.expires_at) || !getVarint(cursor, end, header.key_size) || !getVarint(cursor, end, header.value_size)) {
+                return false;
+            }
+
+            header_size = static_cast<size_t>(cursor - in.data());
+            return true;
+        }
+
+        // Whether key and value sizes read from disk fit in the bytes left after their header.
+        bool fitsIn(const RecordHeader& header, uint64_t available) {
+            return header.key_size <= available && header.value_size <= available - header.key_size;
+        }
+
+        // Reads a file front to back through one buffer refilled in large blocks, handing out
+        // contiguous views so records can be decoded in place.
+        class FileWindow {
+        public:
+            explicit FileWindow(const fs::path& path, const ReadThrottle* throttle = nullptr) :
+                _reader{ path, std::ios::in | std::ios::binary }, _throttle{ throttle } {
+                // Sized from the open stream so a file renamed over path mid-scan cannot confuse it.
+                if (_reader.seekg(0, std::ios::end)) {
+                    _file_size = static_cast<uint64_t>(std::streamoff{ _reader.tellg() });
+                    _reader.seekg(0, std::ios::beg);
+                }
+            }
+
+            bool isOpen() const { return _reader.is_open(); }
+
+            // Makes at least size bytes available unless the file ends first. Returns how many are.
+            size_t fill(size_t size) {
+                if (_end - _begin < size) {
+                    std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+                    _end -= _begin;
+                    _begin = 0;
+
+                    if (_buffer.size() < size) {
+                        _buffer.resize(std::max(size, BLOCK_SIZE));
+                    }
+
+                    while (_end < size && _reader && !_aborted) {
+                        _reader.read(_buffer.data() + _end, static_cast<std::streamsize>(_buffer.size() - _end));
+                        auto read = static_cast<size_t>(_reader.gcount());
+                        _end += read;
+                        _aborted = _throttle && *_throttle && !(*_throttle)(read);
+                    }
+                }
+
+                return _end - _begin;
+            }
+
+            const char* data() const { return _buffer.data() + _begin; }
+
+            // Bytes between the window start and the end of the file, buffered or not.
+            uint64_t remaining() const { return std::max<uint64_t>(_file_size > _offset ? _file_size - _offset : 0, _end - _begin); }
+
+            void consume(size_t size) {
+                _begin += size;
+                _offset += size;
+            }
+
+        private:
+            static constexpr size_t BLOCK_SIZE{ 4 * 1024 * 1024 };
+
+            std::ifstream _reader;
+            const ReadThrottle* _throttle{};
+            bool _aborted{};
+            std::string _buffer{};
+            size_t _begin{};
+            size_t _end{};
+            uint64_t _offset{};
+            uint64_t _file_size{};
+        };
+
+        bool decodeBatch(std::string_view batch, size_t header_size, offset_t batch_pos, std::vector<RecordView>& records) {
+            records.clear();
+
+            if (batch.size() < header_size + sizeof(uint32_t)) {
+                return false;
+            }
+
+            auto count = getFixed<uint32_t>(batch.data() + header_size);
+            size_t offset = header_size + sizeof(uint32_t);
+
+            while (records.size() < count) {
+                RecordHeader header{};
+                size_t nested_header_size{};
+
+                auto rest = batch.substr(offset);
+                if (!parseHeader(rest, header, nested_header_size) || !fitsIn(header, rest.size() - nested_header_size)) {
+                    return false;
+                }
+
+                if (header.type != RecordType::Put && header.type != RecordType::Tombstone) {
+                    return false;
+                }
+
+                auto record = rest.substr(0, nested_header_size + header.key_size + header.value_size);
+                if (header.crc != crc32c(record.substr(sizeof(uint32_t)))) {
+                    return false;
+                }
+
+                auto payload = record.substr(nested_header_size);
+                records.push_back({ header.type, payload.substr(0, header.key_size), payload.substr(header.key_size),
+                    batch_pos + offset, header.expires_at, nested_header_size });
+
+                offset += record.size();
+            }
+
+            return offset == batch.size();
+        }
+    }
+
+    uint32_t crc32c(std::string_view data, uint32_t crc) {
+        static const auto compute = selectCrc32c();
+
+        return ~compute(data.data(), data.size(), ~crc);
+    }
+
+    void appendRecordHeader(std::string& out, RecordType type, std::string_view key, std::string_view value, uint64_t expires_at) {
+        auto start = out.size();
+
+        putFixed<uint32_t>(out, 0);
+        putFixed(out, static_cast<uint8_t>(type));
+        putVarint(out, expires_at);
+        putVarint(out, key.size());
+        putVarint(out, value.size());
+        out.append(key);
+
+        auto crc = crc32c(value, crc32c(std::string_view{ out }.substr(start + sizeof(uint32_t))));
+        std::memcpy(out.data() + start, &crc, sizeof(crc));
+    }
+
+    void appendRecord(std::string& out, RecordType type, std::string_view key, std::string_view value, uint64_t expires_at) {
+        appendRecordHeader(out, type, key, value, expires_at);
+        out.append(value);
+    }
+
+    std::string encodeRecord(RecordType type, std::string_view key, std::string_view value, uint64_t expires_at) {
+        std::string record{};
+        record.reserve(RecordHeader::MAX_SIZE + key.size() + value.size());
+
+        appendRecord(record, type, key, value, expires_at);
+
+        return record;
+    }
+
+    void sealBatch(std::string& batch, uint32_t count) {
+        constexpr auto value_size_pos = RecordHeader::FIXED_SIZE + 2;
+        auto value_size = batch.size() - value_size_pos - MAX_VARINT_SIZE;
+
+        std::string header{};
+        putFixed<uint32_t>(header, 0);
+        putFixed(header, static_cast<uint8_t>(RecordType::Batch));
+        putVarint(header, 0);
+        putVarint(header, 0);
+        putVarint(header, value_size, MAX_VARINT_SIZE);
+        putFixed(header, count);
+        std::memcpy(batch.data(), header.data(), header.size());
+
+        auto crc = crc32c(std::string_view{ batch }.substr(sizeof(uint32_t)));
+        std::memcpy(batch.data(), &crc, sizeof(crc));
+    }
+
+    std::string encodeBlobManifest(const BlobManifest& manifest) {
+        std::string encoded{};
+        encoded.reserve(2 * MAX_VARINT_SIZE + manifest.chunks.size() * 3 * MAX_VARINT_SIZE);
+
+        putVarint(encoded, manifest.total_size);
+        putVarint(encoded, manifest.chunks.size());
+        for (const auto& chunk : manifest.chunks) {
+            putVarint(encoded, chunk.file_id);
+            putVarint(encoded, chunk.value_pos);
+            putVarint(encoded, chunk.size);
+        }
+
+        return encoded;
+    }
+
+    bool decodeBlobManifest(std::string_view encoded, BlobManifest& manifest) {
+        const auto* cursor = encoded.data();
+        const auto* end = encoded.data() + encoded.size();
+
+        uint64_t count{};
+        if (!getVarint(cursor, end, manifest.total_size) || !getVarint(cursor, end, count)) {
+            return false;
+        }
+
+        manifest.chunks.clear();
+        while (manifest.chunks.size() < count) {
+            uint64_t file_id{};
+            BlobChunk chunk{};
+
+            if (!getVarint(cursor, end, file_id) || !getVarint(cursor, end, chunk.value_pos) || !getVarint(cursor, end, chunk.size)) {
+                return false;
+            }
+
+            chunk.file_id = static_cast<data_file_id_t>(file_id);
+            manifest.chunks.push_back(chunk);
+        }
+
+        return cursor == end;
+    }
+
+    void appendHintEntry(std::string& out, const HintEntry& entry) {
+        putFixed(out, static_cast<uint8_t>(entry.type));
+        putVarint(out, entry.expires_at);
+        putVarint(out, entry.key.size());
+        putVarint(out, entry.value_size);
+        putVarint(out, entry.value_pos);
+        out.append(entry.key);
+    }
+
+    void sealHints(std::string& hints, uint64_t data_file_size) {
+        std::memcpy(hints.data() + sizeof(uint32_t), &data_file_size, sizeof(data_file_size));
+
+        auto crc = crc32c(std::string_view{ hints }.substr(sizeof(uint32_t)));
+        std::memcpy(hints.data(), &crc, sizeof(crc));
+    }
+
+    uint64_t scanRecords(const fs::path& data_file, const RecordVisitor& visitor, const ReadThrottle& throttle) {
+        FileWindow window{ data_file, &throttle };
+        std::vector<RecordView> batch{};
+        uint64_t valid_size{};
+
+        while (true) {
+            RecordHeader header{};
+            size_t header_size{};
+
+            auto available = window.fill(RecordHeader::MAX_SIZE);
+            if (!parseHeader({ window.data(), available }, header, header_size) || header.type > RecordType::Blob) {
+                break;
+            }
+
+            if (!fitsIn(header, window.remaining() - header_size)) {
+                break;
+            }
+
+            auto record_size = static_cast<size_t>(header_size + header.key_size + header.value_size);
+            if (window.fill(record_size) < record_size) {
+                break;
+            }
+
+            std::string_view record{ window.data(), record_size };
+
+            if (header.crc != crc32c(record.substr(sizeof(uint32_t)))) {
+                break;
+            }
+
+            if (header.type == RecordType::Batch) {
+                // Batches are applied all or nothing: every nested record is checked before any is visited.
+                if (!decodeBatch(record, header_size, valid_size, batch)) {
+                    break;
+                }
+
+                for (const auto& nested : batch) {
+                    visitor(nested);
+                }
+            }
+            else {
+                auto payload = record.substr(header_size);
+                visitor({ header.type, payload.substr(0, header.key_size), payload.substr(header.key_size), valid_size, header.expires_at, header_size });
+            }
+
+            window.consume(record_size);
+            valid_size += record_size;
+        }
+
+        return valid_size;
+    }
+
+    bool scanHints(const fs::path& hint_file, uint64_t data_file_size, const HintVisitor& visitor) {
+        // The whole file is checked before the first entry is visited, so a damaged hint never
+        // leaves half of its entries applied behind the data file scan that replaces it.
+        FileWindow checked{ hint_file };
+        if (!checked.isOpen() || checked.fill(HINT_HEADER_SIZE) < HINT_HEADER_SIZE) {
+            return false;
+        }
+
+        auto expected = getFixed<uint32_t>(checked.data());
+        if (getFixed<uint64_t>(checked.data() + sizeof(uint32_t)) != data_file_size) {
+            return false;
+        }
+        checked.consume(sizeof(uint32_t));
+
+        uint32_t crc{};
+        while (auto available = checked.fill(1)) {
+            crc = crc32c({ checked.data(), available }, crc);
+            checked.consume(available);
+        }
+
+        if (crc != expected) {
+            return false;
+        }
+
+        FileWindow window{ hint_file };
+        if (window.fill(HINT_HEADER_SIZE) < HINT_HEADER_SIZE) {
+            return false;
+        }
+        window.consume(HINT_HEADER_SIZE);
+
+        while (auto available = window.fill(HintEntry::MAX_HEADER_SIZE)) {
+            const auto* cursor = window.data() + sizeof(uint8_t);
+            const auto* end = window.data() + available;
+
+            auto type = static_cast<RecordType>(getFixed<uint8_t>(window.data()));
+            uint64_t expires_at{};
+            uint64_t key_size{};
+            HintEntry entry{};
+
+            if (!getVarint(cursor, end, expires_at) || !getVarint(cursor, end, key_size)
+                || !getVarint(cursor, end, entry.value_size) || !getVarint(cursor, end, entry.value_pos)) {
+                return false;
+            }
+
+            auto header_size = static_cast<size_t>(cursor - window.data());
+            if (key_size > window.remaining() - header_size) {
+                return false;
+            }
+
+            auto entry_size = static_cast<size_t>(header_size + key_size);
+            if (window.fill(entry_size) < entry_size) {
+                return false;
+            }
+
+            entry.type = type;
+            entry.expires_at = expires_at;
+            entry.key = { window.data() + header_size, static_cast<size_t>(key_size) };
+            visitor(entry);
+
+            window.consume(entry_size);
+        }
+
+        return true;
+    }
+}
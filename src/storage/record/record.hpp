@@ -0,0 +1,120 @@
+#pragma once
+
+#include <storage_utils.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cosmo::storage {
+    enum class RecordType : uint8_t {
+        Put = 0,
+        Tombstone = 1,
+        Batch = 2,
+        Chunk = 3,
+        Blob = 4,
+    };
+
+    // Unsigned LEB128: 7 bits per byte, low bits first, high bit set on every byte but the last.
+    inline constexpr size_t MAX_VARINT_SIZE{ 10 };
+
+    // On-disk layout of a record:
+    // | crc32c (4) | type (1) | expires_at (varint) | key_size (varint) | value_size (varint) | key | value |
+    // The checksum covers everything that follows it. expires_at is in milliseconds since
+    // the epoch, 0 meaning the record never expires.
+    struct RecordHeader {
+        uint32_t crc{};
+        RecordType type{ RecordType::Put };
+        uint64_t expires_at{};
+        uint64_t key_size{};
+        uint64_t value_size{};
+
+        static constexpr size_t FIXED_SIZE{ sizeof(uint32_t) + sizeof(uint8_t) };
+        static constexpr size_t MAX_SIZE{ FIXED_SIZE + 3 * MAX_VARINT_SIZE };
+    };
+
+    struct RecordView {
+        RecordType type{};
+        std::string_view key{};
+        std::string_view value{};
+        offset_t pos{};
+        uint64_t expires_at{};
+        size_t header_size{};
+
+        offset_t valuePos() const { return pos + header_size + key.size(); }
+    };
+
+    // Hint files mirror a merged data file without its values:
+    // | crc32c (4) | data_file_size (8) | entry... |, where the checksum covers everything after it,
+    // the size ties the hint to the data file it was written for and each entry is
+    // | type (1) | expires_at (varint) | key_size (varint) | value_size (varint) | value_pos (varint) | key |
+    struct HintEntry {
+        RecordType type{};
+        std::string_view key{};
+        data_file_size_t value_size{};
+        offset_t value_pos{};
+        uint64_t expires_at{};
+
+        static constexpr size_t MAX_HEADER_SIZE{ sizeof(uint8_t) + 4 * MAX_VARINT_SIZE };
+    };
+
+    inline constexpr size_t HINT_HEADER_SIZE{ sizeof(uint32_t) + sizeof(uint64_t) };
+
+    // A batch is one record whose value is | count (4) | record... |, so a single checksum
+    // covers every nested put and tombstone and recovery applies all of them or none. Its
+    // value_size is padded to MAX_VARINT_SIZE bytes so the header can be reserved up front.
+    inline constexpr size_t BATCH_HEADER_SIZE{ RecordHeader::FIXED_SIZE + 2 + MAX_VARINT_SIZE + sizeof(uint32_t) };
+
+    // A streamed value is written as Chunk records followed by a Blob record whose value is
+    // the manifest | total_size | count | (file_id | value_pos | size)... |, all varints.
+    struct BlobChunk {
+        data_file_id_t file_id{};
+        offset_t value_pos{};
+        data_file_size_t size{};
+    };
+
+    struct BlobManifest {
+        uint64_t total_size{};
+        std::vector<BlobChunk> chunks{};
+    };
+
+    using RecordVisitor = std::function<void(const RecordView&)>;
+    using HintVisitor = std::function<void(const HintEntry&)>;
+
+    // Called with the size of every block a scan reads; returning false ends the scan there.
+    using ReadThrottle = std::function<bool(size_t)>;
+
+    uint32_t crc32c(std::string_view data, uint32_t crc = 0);
+
+    // Appends the header and key of a record whose checksum already accounts for value, so the
+    // value itself can be written from the caller's memory right after them.
+    void appendRecordHeader(std::string& out, RecordType type, std::string_view key, std::string_view value, uint64_t expires_at = 0);
+
+    void appendRecord(std::string& out, RecordType type, std::string_view key, std::string_view value, uint64_t expires_at = 0);
+
+    std::string encodeRecord(RecordType type, std::string_view key, std::string_view value, uint64_t expires_at = 0);
+
+    std::string encodeBlobManifest(const BlobManifest& manifest);
+
+    bool decodeBlobManifest(std::string_view encoded, BlobManifest& manifest);
+
+    // Fills the batch header of a buffer that starts with BATCH_HEADER_SIZE reserved bytes followed by the nested records.
+    void sealBatch(std::string& batch, uint32_t count);
+
+    void appendHintEntry(std::string& out, const HintEntry& entry);
+
+    // Fills the header of a buffer that starts with HINT_HEADER_SIZE reserved bytes followed by the entries.
+    void sealHints(std::string& hints, uint64_t data_file_size);
+
+    // Walks the records of a data file in order, unpacking batches, and stops at the first one that is
+    // truncated or fails its checksum. Returns the size of the valid prefix.
+    uint64_t scanRecords(const fs::path& data_file, const RecordVisitor& visitor, const ReadThrottle& throttle = {});
+
+    // Visits every entry of a hint file, or none of them when the file is truncated, fails its
+    // checksum or was written for a data file of another size; the caller then has to scan the
+    // data file instead.
+    bool scanHints(const fs::path& hint_file, uint64_t data_file_size, const HintVisitor& visitor);
+}
@@ -0,0 +1,116 @@
+#include "scrubber.hpp"
+
+#include "storage.hpp"
+#include "log/logger.hpp"
+#include "record/record.hpp"
+
+#include <algorithm>
+
+namespace cosmo::storage {
+    Scrubber::Scrubber(Storage& storage, uint64_t bytes_per_second, CorruptionHandler on_corruption) :
+        _storage{ storage }, _bytes_per_second{ bytes_per_second }, _on_corruption{ std::move(on_corruption) } {}
+
+    Scrubber::~Scrubber() {
+        stop();
+    }
+
+    void Scrubber::start(std::chrono::milliseconds interval) {
+        std::scoped_lock lck{ _mtx };
+
+        if (_worker.joinable()) {
+            return;
+        }
+
+        _stopping = false;
+        _worker = std::thread{ [this, interval] {
+            std::unique_lock lck{ _mtx };
+
+            while (!_stopping) {
+                lck.unlock();
+                scrub();
+                lck.lock();
+
+                _cv.wait_for(lck, interval, [this] { return _stopping; });
+            }
+        } };
+    }
+
+    void Scrubber::stop() {
+        {
+            std::scoped_lock lck{ _mtx };
+            _stopping = true;
+        }
+        _cv.notify_all();
+
+        if (_worker.joinable() && _worker.get_id() != std::this_thread::get_id()) {
+            _worker.join();
+        }
+    }
+
+    size_t Scrubber::scrub() {
+        std::scoped_lock pass_lck{ _pass_mtx };
+
+        auto data_files = _storage.getDataFiles();
+        size_t corrupt_ranges{};
+
+        for (data_file_id_t id = 0; id < data_files.size(); ++id) {
+            const auto& path = data_files.at(id).getPath();
+
+            // The scan stops at the first bad record; everything from there on is unverifiable.
+            auto valid_size = scanRecords(path, [](const RecordView&) {}, [this](size_t bytes) { return throttle(bytes); });
+
+            {
+                std::scoped_lock lck{ _mtx };
+                if (_stopping) {
+                    return corrupt_ranges;
+                }
+            }
+
+            std::error_code ec{};
+            auto file_size = fs::file_size(path, ec);
+
+            // A merge swapped the file while it was read; the new one gets verified next pass.
+            if (ec || _storage.getDataFiles().segment(id) != data_files.segment(id)) {
+                continue;
+            }
+
+            _files_verified++;
+            _bytes_verified += valid_size;
+
+            if (valid_size < file_size) {
+                ++corrupt_ranges;
+                _corrupt_ranges++;
+
+                sharedLogger().log(LogLevel::Error, LogEvent::Scrub, "checksum mismatch in {} between bytes {} and {}", path, valid_size, file_size);
+
+                if (_on_corruption) {
+                    _on_corruption(id, valid_size, file_size);
+                }
+            }
+        }
+
+        _passes++;
+
+        return corrupt_ranges;
+    }
+
+    Scrubber::Stats Scrubber::stats() const {
+        return { _passes.load(), _files_verified.load(), _bytes_verified.load(), _corrupt_ranges.load() };
+    }
+
+    bool Scrubber::throttle(size_t bytes) {
+        std::unique_lock lck{ _mtx };
+
+        if (_bytes_per_second == 0) {
+            return !_stopping;
+        }
+
+        // Each block pushes the next read back by the time it is worth under the budget.
+        auto now = std::chrono::steady_clock::now();
+        auto cost = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>{ static_cast<double>(bytes) / static_cast<double>(_bytes_per_second) });
+        _next_read = std::max(_next_read, now) + cost;
+
+        return !_cv.wait_until(lck, _next_read, [this] { return _stopping; });
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <storage_utils.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace cosmo::storage {
+    class Storage;
+
+    // Walks the immutable data files in the background and verifies every record checksum,
+    // so bitrot is found before a read trips over it. Reads are paced to a bytes/sec budget
+    // to leave the disk to foreground traffic.
+    class Scrubber {
+    public:
+        struct Stats {
+            uint64_t passes{};
+            uint64_t files_verified{};
+            uint64_t bytes_verified{};
+            uint64_t corrupt_ranges{};
+        };
+
+        // Receives the file and the [begin, end) range following the last valid record of a
+        // damaged file. Runs on the scrubber thread and again on every pass that finds it.
+        using CorruptionHandler = std::function<void(data_file_id_t, offset_t, offset_t)>;
+
+        Scrubber(Storage& storage, uint64_t bytes_per_second, CorruptionHandler on_corruption);
+        ~Scrubber();
+
+        Scrubber(const Scrubber&) = delete;
+        Scrubber& operator=(const Scrubber&) = delete;
+
+        // Starts a thread running a pass every interval until stop().
+        void start(std::chrono::milliseconds interval);
+
+        void stop();
+
+        // Verifies every immutable data file once on the calling thread. Returns the number of
+        // corrupt ranges found.
+        size_t scrub();
+
+        Stats stats() const;
+
+    private:
+        bool throttle(size_t bytes);
+
+        Storage& _storage;
+        uint64_t _bytes_per_second{};
+        CorruptionHandler _on_corruption{};
+
+        std::mutex _pass_mtx;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        bool _stopping{};
+        std::thread _worker{};
+        std::chrono::steady_clock::time_point _next_read{};
+
+        std::atomic<uint64_t> _passes{};
+        std::atomic<uint64_t> _files_verified{};
+        std::atomic<uint64_t> _bytes_verified{};
+        std::atomic<uint64_t> _corrupt_ranges{};
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace cosmo::storage {
+    enum class IoCounter : uint8_t {
+        // Key and value bytes handed to the engine by callers.
+        UserBytesWritten = 0,
+        // Bytes appended to the active data file, buffered writes counted when flushed.
+        DataBytesWritten = 1,
+        MergeBytesWritten = 2,
+        HintBytesWritten = 3,
+        MergeBytesRead = 4,
+        Fsyncs = 5,
+    };
+
+    inline constexpr size_t IO_COUNTER_COUNT{ 6 };
+
+    struct IoStats {
+        uint64_t user_bytes_written{};
+        uint64_t data_bytes_written{};
+        uint64_t merge_bytes_written{};
+        uint64_t hint_bytes_written{};
+        uint64_t merge_bytes_read{};
+        uint64_t fsyncs{};
+        // Size of the data, active and hint files at the time of the snapshot, tracked as they
+        // change rather than read from the file system.
+        uint64_t disk_bytes{};
+    };
+
+    // Monotonic byte and operation counters. Each sits on its own cache line so the writers
+    // of different counters never share one.
+    class IoCounters {
+    public:
+        void add(IoCounter counter, uint64_t amount) {
+            _counters[static_cast<size_t>(counter)].value.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        uint64_t get(IoCounter counter) const {
+            return _counters[static_cast<size_t>(counter)].value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct alignas(64) Counter {
+            std::atomic<uint64_t> value{};
+        };
+
+        std::array<Counter, IO_COUNTER_COUNT> _counters{};
+    };
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cosmo::storage {
+    enum class LatencyOp : uint8_t {
+        Read = 0,
+        Write = 1,
+        Flush = 2,
+        Rollover = 3,
+        Fsync = 4,
+        Merge = 5,
+    };
+
+    inline constexpr size_t LATENCY_OP_COUNT{ 6 };
+
+    struct LatencySummary {
+        uint64_t count{};
+        uint64_t min{};
+        uint64_t mean{};
+        uint64_t p50{};
+        uint64_t p90{};
+        uint64_t p99{};
+        uint64_t p999{};
+        uint64_t max{};
+    };
+
+    struct LatencyStats {
+        LatencySummary read{};
+        LatencySummary write{};
+        LatencySummary flush{};
+        LatencySummary rollover{};
+        LatencySummary fsync{};
+        LatencySummary merge{};
+    };
+
+    // Log-linear (HDR) histogram of nanosecond latencies: values below 128 get their own
+    // bucket, larger ones 64 buckets per power of two, so any recorded value is off by at most
+    // 1/64 of itself. Values past the top bucket (about 2^40 ns, 18 minutes) are clamped.
+    class Histogram {
+    public:
+        static constexpr size_t SUB_BUCKET_BITS{ 7 };
+        static constexpr size_t SUB_BUCKETS{ size_t{ 1 } << SUB_BUCKET_BITS };
+        static constexpr size_t HALF_SUB_BUCKETS{ SUB_BUCKETS / 2 };
+        static constexpr size_t MAX_SHIFT{ 33 };
+        static constexpr size_t BUCKETS{ SUB_BUCKETS + MAX_SHIFT * HALF_SUB_BUCKETS };
+
+        static size_t bucketIndex(uint64_t value) {
+            if (value < SUB_BUCKETS) {
+                return static_cast<size_t>(value);
+            }
+
+            auto shift = std::min<size_t>(std::bit_width(value) - SUB_BUCKET_BITS, MAX_SHIFT);
+            auto sub_bucket = std::min<uint64_t>(value >> shift, SUB_BUCKETS - 1);
+
+            return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + static_cast<size_t>(sub_bucket - HALF_SUB_BUCKETS);
+        }
+
+        // Highest value that lands in the bucket.
+        static uint64_t bucketValue(size_t index) {
+            if (index < SUB_BUCKETS) {
+                return index;
+            }
+
+            auto shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+            auto sub_bucket = (index - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+
+            return ((uint64_t{ sub_bucket } + 1) << shift) - 1;
+        }
+
+        void record(uint64_t value, uint64_t count = 1) {
+            _counts[bucketIndex(value)] += count;
+            _total += count;
+            _sum += value * count;
+            _min = _total == count ? value : std::min(_min, value);
+            _max = std::max(_max, value);
+        }
+
+        void merge(const Histogram& other) {
+            if (other._total == 0) {
+                return;
+            }
+
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                _counts[i] += other._counts[i];
+            }
+
+            _min = _total == 0 ? other._min : std::min(_min, other._min);
+            _max = std::max(_max, other._max);
+            _total += other._total;
+            _sum += other._sum;
+        }
+
+        uint64_t count() const { return _total; }
+
+        uint64_t min() const { return _min; }
+
+        uint64_t max() const { return _max; }
+
+        uint64_t mean() const { return _total ? _sum / _total : 0; }
+
+        uint64_t sum() const { return _sum; }
+
+        // Values recorded up to value, give or take the bucket precision.
+        uint64_t countAtMost(uint64_t value) const {
+            uint64_t count{};
+            for (size_t i = 0, last = bucketIndex(value); i <= last; ++i) {
+                count += _counts[i];
+            }
+            return count;
+        }
+
+        uint64_t percentile(double percentile) const {
+            if (_total == 0) {
+                return 0;
+            }
+
+            auto rank = static_cast<uint64_t>(std::max(1.0, percentile / 100.0 * static_cast<double>(_total) + 0.5));
+            uint64_t seen{};
+
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                seen += _counts[i];
+                if (seen >= rank) {
+                    return std::clamp(bucketValue(i), _min, _max);
+                }
+            }
+
+            return _max;
+        }
+
+        LatencySummary summary() const {
+            return { count(), min(), mean(), percentile(50), percentile(90), percentile(99), percentile(99.9), max() };
+        }
+
+    private:
+        std::array<uint64_t, BUCKETS> _counts{};
+        uint64_t _total{};
+        uint64_t _sum{};
+        uint64_t _min{};
+        uint64_t _max{};
+
+        template<size_t>
+        friend class HistogramRecorder;
+    };
+
+    // A fixed set of histograms each thread records into privately, each on its own cache
+    // lines, so the hot path is a few uncontended relaxed stores. snapshot() merges all threads.
+    // A thread hands its set back when it exits and the next new thread carries on counting in
+    // it, so sets are only allocated for as many threads as ever recorded at the same time.
+    template<size_t COUNT>
+    class HistogramRecorder {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        HistogramRecorder() : _id{ nextId() } {}
+
+        HistogramRecorder(const HistogramRecorder&) = delete;
+        HistogramRecorder& operator=(const HistogramRecorder&) = delete;
+
+        void record(size_t index, uint64_t nanos) {
+            auto& histogram = local().histograms[index];
+
+            auto& bucket = histogram.counts[Histogram::bucketIndex(nanos)];
+            bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            histogram.sum.store(histogram.sum.load(std::memory_order_relaxed) + nanos, std::memory_order_relaxed);
+
+            if (nanos < histogram.min.load(std::memory_order_relaxed)) {
+                histogram.min.store(nanos, std::memory_order_relaxed);
+            }
+            if (nanos > histogram.max.load(std::memory_order_relaxed)) {
+                histogram.max.store(nanos, std::memory_order_relaxed);
+            }
+        }
+
+        void record(size_t index, Clock::time_point start) {
+            record(index, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+
+        Histogram snapshot(size_t index) const {
+            Histogram merged{};
+
+            std::scoped_lock lck{ _state->mtx };
+
+            for (const auto& thread : _state->threads) {
+                const auto& histogram = thread->histograms[index];
+
+                Histogram local{};
+                for (size_t i = 0; i < Histogram::BUCKETS; ++i) {
+                    local._counts[i] = histogram.counts[i].load(std::memory_order_relaxed);
+                    local._total += local._counts[i];
+                }
+                local._sum = histogram.sum.load(std::memory_order_relaxed);
+                local._min = histogram.min.load(std::memory_order_relaxed);
+                local._max = histogram.max.load(std::memory_order_relaxed);
+
+                merged.merge(local);
+            }
+
+            return merged;
+        }
+
+        // Clears every histogram. Samples recorded concurrently may survive in part.
+        void reset() {
+            std::scoped_lock lck{ _state->mtx };
+
+            for (auto& thread : _state->threads) {
+                for (auto& histogram : thread->histograms) {
+                    for (auto& count : histogram.counts) {
+                        count.store(0, std::memory_order_relaxed);
+                    }
+                    histogram.sum.store(0, std::memory_order_relaxed);
+                    histogram.min.store(UINT64_MAX, std::memory_order_relaxed);
+                    histogram.max.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Per-thread sets allocated so far, handed back ones included.
+        size_t threadSlots() const {
+            std::scoped_lock lck{ _state->mtx };
+            return _state->threads.size();
+        }
+
+    private:
+        struct alignas(64) ThreadHistogram {
+            std::array<std::atomic<uint64_t>, Histogram::BUCKETS> counts{};
+            std::atomic<uint64_t> sum{};
+            std::atomic<uint64_t> min{ UINT64_MAX };
+            std::atomic<uint64_t> max{};
+        };
+
+        struct alignas(64) ThreadHistograms {
+            std::array<ThreadHistogram, COUNT> histograms{};
+        };
+
+        // Recently used recorders of this thread. Ids are never reused, so a stale entry of a
+        // destroyed recorder can never match a new one.
+        struct CacheEntry {
+            uint64_t id{};
+            ThreadHistograms* histograms{};
+        };
+
+        // Shared with the threads recording into it, which may outlive the recorder.
+        struct State {
+            std::mutex mtx;
+            std::vector<std::unique_ptr<ThreadHistograms>> threads{};
+            // Thread owning each set, or a default id once its thread exited.
+            std::vector<std::thread::id> owners{};
+
+            void release(const ThreadHistograms* histograms) {
+                std::scoped_lock lck{ mtx };
+
+                for (size_t i = 0; i < threads.size(); ++i) {
+                    if (threads[i].get() == histograms) {
+                        owners[i] = {};
+                    }
+                }
+            }
+        };
+
+        // Sets this thread took, handed back from its thread_local destructor.
+        struct ThreadSlots {
+            std::vector<std::pair<std::weak_ptr<State>, const ThreadHistograms*>> held{};
+
+            ~ThreadSlots() {
+                for (const auto& [state, histograms] : held) {
+                    if (auto alive = state.lock()) {
+                        alive->release(histograms);
+                    }
+                }
+            }
+        };
+
+        static constexpr size_t THREAD_CACHE_SIZE{ 4 };
+
+        uint64_t _id{};
+        std::shared_ptr<State> _state{ std::make_shared<State>() };
+
+        static uint64_t nextId() {
+            static std::atomic<uint64_t> next{ 1 };
+            return next.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ThreadHistograms& local() {
+            thread_local std::array<CacheEntry, THREAD_CACHE_SIZE> cache{};
+            thread_local size_t next_victim{};
+
+            for (const auto& entry : cache) {
+                if (entry.id == _id) {
+                    return *entry.histograms;
+                }
+            }
+
+            auto* histograms = registerThread();
+            cache[next_victim] = { _id, histograms };
+            next_victim = (next_victim + 1) % THREAD_CACHE_SIZE;
+
+            return *histograms;
+        }
+
+        ThreadHistograms* registerThread() {
+            thread_local ThreadSlots slots{};
+
+            auto self = std::this_thread::get_id();
+            ThreadHistograms* histograms{};
+
+            {
+                std::scoped_lock lck{ _state->mtx };
+
+                auto& owners = _state->owners;
+                auto& threads = _state->threads;
+
+                // The set may only have been evicted from the thread cache.
+                if (auto it = std::find(owners.begin(), owners.end(), self); it != owners.end()) {
+                    return threads[static_cast<size_t>(it - owners.begin())].get();
+                }
+
+                if (auto it = std::find(owners.begin(), owners.end(), std::thread::id{}); it != owners.end()) {
+                    *it = self;
+                    histograms = threads[static_cast<size_t>(it - owners.begin())].get();
+                }
+                else {
+                    threads.push_back(std::make_unique<ThreadHistograms>());
+                    owners.push_back(self);
+                    histograms = threads.back().get();
+                }
+            }
+
+            std::erase_if(slots.held, [](const auto& held) { return held.first.expired(); });
+            slots.held.emplace_back(_state, histograms);
+
+            return histograms;
+        }
+    };
+
+    // Per-operation latencies of one storage instance.
+    class LatencyRecorder {
+    public:
+        using Clock = HistogramRecorder<LATENCY_OP_COUNT>::Clock;
+
+        void record(LatencyOp op, uint64_t nanos) {
+            _histograms.record(static_cast<size_t>(op), nanos);
+        }
+
+        void record(LatencyOp op, Clock::time_point start) {
+            _histograms.record(static_cast<size_t>(op), start);
+        }
+
+        Histogram snapshot(LatencyOp op) const {
+            return _histograms.snapshot(static_cast<size_t>(op));
+        }
+
+        LatencySummary summary(LatencyOp op) const {
+            return snapshot(op).summary();
+        }
+
+        LatencyStats stats() const {
+            return {
+                summary(LatencyOp::Read),
+                summary(LatencyOp::Write),
+                summary(LatencyOp::Flush),
+                summary(LatencyOp::Rollover),
+                summary(LatencyOp::Fsync),
+                summary(LatencyOp::Merge),
+            };
+        }
+
+    private:
+        HistogramRecorder<LATENCY_OP_COUNT> _histograms{};
+    };
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "latency.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace cosmo::storage {
+    enum class LockSite : uint8_t {
+        ReadBuffer = 0,
+        DataFile = 1,
+        SegmentTable = 2,
+        Strategy = 3,
+    };
+
+    inline constexpr size_t LOCK_SITE_COUNT{ 4 };
+
+    inline constexpr std::array<std::string_view, LOCK_SITE_COUNT> LOCK_SITE_NAMES{ "read_buffer", "data_file", "segment_table", "strategy" };
+
+    struct LockSiteStats {
+        LockSite site{};
+        bool shared{};
+        uint64_t acquisitions{};
+        uint64_t contended{};
+        // Wait covers contended acquisitions only; hold covers every acquisition.
+        LatencySummary wait{};
+        LatencySummary hold{};
+    };
+
+    // Process-wide wait and hold time histograms per lock site and mode, fed by ProfiledMutex.
+    class LockProfiler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        void recordWait(LockSite site, bool shared, Clock::time_point start) {
+            _histograms.record(index(site, shared, WAIT), start);
+        }
+
+        void recordHold(LockSite site, bool shared, Clock::time_point start) {
+            _histograms.record(index(site, shared, HOLD), start);
+        }
+
+        // Sites and modes that were acquired at least once.
+        std::vector<LockSiteStats> stats() const {
+            std::vector<LockSiteStats> stats{};
+
+            for (size_t site = 0; site < LOCK_SITE_COUNT; ++site) {
+                for (bool shared : { false, true }) {
+                    auto hold = _histograms.snapshot(index(static_cast<LockSite>(site), shared, HOLD));
+                    if (hold.count() == 0) {
+                        continue;
+                    }
+
+                    auto wait = _histograms.snapshot(index(static_cast<LockSite>(site), shared, WAIT));
+                    stats.push_back({ static_cast<LockSite>(site), shared, hold.count(), wait.count(), wait.summary(), hold.summary() });
+                }
+            }
+
+            return stats;
+        }
+
+        void reset() {
+            _histograms.reset();
+        }
+
+    private:
+        static constexpr size_t WAIT{ 0 };
+        static constexpr size_t HOLD{ 1 };
+
+        HistogramRecorder<LOCK_SITE_COUNT * 2 * 2> _histograms{};
+
+        static size_t index(LockSite site, bool shared, size_t kind) {
+            return (static_cast<size_t>(site) * 2 + (shared ? 1 : 0)) * 2 + kind;
+        }
+    };
+
+    inline LockProfiler& lockProfiler() {
+        static LockProfiler profiler{};
+        return profiler;
+    }
+
+#ifdef COSMO_PROFILE_LOCKS
+    inline constexpr bool LOCK_PROFILING{ true };
+
+    // Drop-in for std::mutex or std::shared_mutex that records, per lock site, how long
+    // contended acquisitions waited and how long the lock was held.
+    template<typename Mutex>
+    class ProfiledMutex {
+    public:
+        using Clock = LockProfiler::Clock;
+
+        explicit ProfiledMutex(LockSite site) : _site{ site } {}
+
+        ProfiledMutex(const ProfiledMutex&) = delete;
+        ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+        void lock() {
+            if (!_mtx.try_lock()) {
+                auto start = Clock::now();
+                _mtx.lock();
+                lockProfiler().recordWait(_site, false, start);
+            }
+            _held_since = Clock::now();
+        }
+
+        bool try_lock() {
+            if (!_mtx.try_lock()) {
+                return false;
+            }
+            _held_since = Clock::now();
+            return true;
+        }
+
+        void unlock() {
+            auto held_since = _held_since;
+            _mtx.unlock();
+            lockProfiler().recordHold(_site, false, held_since);
+        }
+
+        void lock_shared() requires requires(Mutex& mutex) { mutex.lock_shared(); } {
+            if (!_mtx.try_lock_shared()) {
+                auto start = Clock::now();
+                _mtx.lock_shared();
+                lockProfiler().recordWait(_site, true, start);
+            }
+            sharedHeldSince()[static_cast<size_t>(_site)] = Clock::now();
+        }
+
+        bool try_lock_shared() requires requires(Mutex& mutex) { mutex.try_lock_shared(); } {
+            if (!_mtx.try_lock_shared()) {
+                return false;
+            }
+            sharedHeldSince()[static_cast<size_t>(_site)] = Clock::now();
+            return true;
+        }
+
+        void unlock_shared() requires requires(Mutex& mutex) { mutex.unlock_shared(); } {
+            auto held_since = sharedHeldSince()[static_cast<size_t>(_site)];
+            _mtx.unlock_shared();
+            lockProfiler().recordHold(_site, true, held_since);
+        }
+
+    private:
+        Mutex _mtx;
+        LockSite _site{};
+        Clock::time_point _held_since{};
+
+        // Shared owners are many, so each thread keeps its own acquisition time per site.
+        static std::array<Clock::time_point, LOCK_SITE_COUNT>& sharedHeldSince() {
+            thread_local std::array<Clock::time_point, LOCK_SITE_COUNT> held_since{};
+            return held_since;
+        }
+    };
+#else
+    inline constexpr bool LOCK_PROFILING{ false };
+
+    // Without COSMO_PROFILE_LOCKS the site is ignored and this is the plain mutex.
+    template<typename Mutex>
+    class ProfiledMutex : public Mutex {
+    public:
+        explicit ProfiledMutex(LockSite) {}
+    };
+#endif
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace cosmo::storage {
+    enum class PhaseOp : uint8_t {
+        Read = 0,
+        Write = 1,
+    };
+
+    inline constexpr size_t PHASE_OP_COUNT{ 2 };
+
+    enum class Phase : uint8_t {
+        LockWait = 0,
+        BufferReserve = 1,
+        Copy = 2,
+        Syscall = 3,
+        Checksum = 4,
+        Index = 5,
+    };
+
+    inline constexpr size_t PHASE_COUNT{ 6 };
+
+    inline constexpr std::array<std::string_view, PHASE_COUNT> PHASE_NAMES{ "lock_wait", "buffer_reserve", "memcpy", "syscall", "checksum", "index" };
+
+    // Time of one kind of operation on one thread, in nanoseconds. Each phase counts only its
+    // own time, without the phases nested in it; whatever is left of total is unattributed.
+    struct PhaseBreakdown {
+        uint64_t operations{};
+        uint64_t total{};
+        std::array<uint64_t, PHASE_COUNT> phases{};
+    };
+
+    struct ThreadPhaseStats {
+        // Threads are numbered in the order of their first profiled operation. A thread that exits
+        // hands its number, and its totals, on to the next new thread.
+        size_t thread{};
+        std::array<PhaseBreakdown, PHASE_OP_COUNT> operations{};
+    };
+
+    // Process-wide per-thread phase totals, fed by PhaseOperation and PhaseTimer. Samples are taken
+    // with rdtsc on x86-64 and the steady clock elsewhere; ticks become nanoseconds when read.
+    // Like HistogramRecorder, totals are only allocated for as many threads as ran at once.
+    class PhaseProfiler {
+    public:
+        struct alignas(64) ThreadTotals {
+            struct Operation {
+                std::atomic<uint64_t> operations{};
+                std::atomic<uint64_t> total{};
+                std::array<std::atomic<uint64_t>, PHASE_COUNT> phases{};
+            };
+
+            std::array<Operation, PHASE_OP_COUNT> operations{};
+        };
+
+        PhaseProfiler() : _origin_ticks{ ticks() }, _origin_time{ std::chrono::steady_clock::now() } {}
+
+        PhaseProfiler(const PhaseProfiler&) = delete;
+        PhaseProfiler& operator=(const PhaseProfiler&) = delete;
+
+        static uint64_t ticks() {
+#if defined(__x86_64__) || defined(_M_X64)
+            return __rdtsc();
+#else
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+        }
+
+        // Only the owning thread writes its totals, so a relaxed load and store is enough.
+        static void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        ThreadTotals& local() {
+            thread_local ThreadSlot slot{ _state, registerThread() };
+            return *slot.totals;
+        }
+
+        // Threads that completed at least one profiled operation.
+        std::vector<ThreadPhaseStats> stats() const {
+            auto scale = nanosPerTick();
+            auto nanos = [scale](const std::atomic<uint64_t>& ticks) {
+                return static_cast<uint64_t>(static_cast<double>(ticks.load(std::memory_order_relaxed)) * scale);
+            };
+
+            std::vector<ThreadPhaseStats> stats{};
+
+            std::scoped_lock lck{ _state->mtx };
+            const auto& threads = _state->threads;
+
+            for (size_t thread = 0; thread < threads.size(); ++thread) {
+                ThreadPhaseStats thread_stats{ thread };
+                bool active{};
+
+                for (size_t op = 0; op < PHASE_OP_COUNT; ++op) {
+                    const auto& totals = threads[thread]->operations[op];
+                    auto& breakdown = thread_stats.operations[op];
+
+                    breakdown.operations = totals.operations.load(std::memory_order_relaxed);
+                    breakdown.total = nanos(totals.total);
+                    for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+                        breakdown.phases[phase] = nanos(totals.phases[phase]);
+                    }
+
+                    active = active || breakdown.operations > 0;
+                }
+
+                if (active) {
+                    stats.push_back(thread_stats);
+                }
+            }
+
+            return stats;
+        }
+
+        // Clears every total. Operations in flight may survive in part.
+        void reset() {
+            std::scoped_lock lck{ _state->mtx };
+
+            for (auto& thread : _state->threads) {
+                for (auto& totals : thread->operations) {
+                    totals.operations.store(0, std::memory_order_relaxed);
+                    totals.total.store(0, std::memory_order_relaxed);
+                    for (auto& phase : totals.phases) {
+                        phase.store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+    private:
+        // Shared with the threads holding totals, which may outlive the profiler.
+        struct State {
+            std::mutex mtx;
+            std::vector<std::unique_ptr<ThreadTotals>> threads{};
+            // Whether a live thread holds each totals.
+            std::vector<bool> held{};
+        };
+
+        // Hands the totals of the thread back from its thread_local destructor.
+        struct ThreadSlot {
+            std::weak_ptr<State> state{};
+            ThreadTotals* totals{};
+
+            ~ThreadSlot() {
+                auto alive = state.lock();
+                if (!alive) {
+                    return;
+                }
+
+                std::scoped_lock lck{ alive->mtx };
+                for (size_t i = 0; i < alive->threads.size(); ++i) {
+                    if (alive->threads[i].get() == totals) {
+                        alive->held[i] = false;
+                    }
+                }
+            }
+        };
+
+        uint64_t _origin_ticks{};
+        std::chrono::steady_clock::time_point _origin_time{};
+        std::shared_ptr<State> _state{ std::make_shared<State>() };
+
+        ThreadTotals* registerThread() {
+            std::scoped_lock lck{ _state->mtx };
+
+            auto& held = _state->held;
+            auto& threads = _state->threads;
+
+            if (auto it = std::find(held.begin(), held.end(), false); it != held.end()) {
+                *it = true;
+                return threads[static_cast<size_t>(it - held.begin())].get();
+            }
+
+            threads.push_back(std::make_unique<ThreadTotals>());
+            held.push_back(true);
+            return threads.back().get();
+        }
+
+        // The tick rate is measured against the steady clock over the profiler's lifetime, which
+        // keeps calibration off the hot path and gets more precise the longer the process runs.
+        double nanosPerTick() const {
+            auto elapsed_ticks = ticks() - _origin_ticks;
+            auto elapsed_nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _origin_time).count();
+
+            return elapsed_ticks > 0 ? elapsed_nanos / static_cast<double>(elapsed_ticks) : 1.0;
+        }
+    };
+
+    inline PhaseProfiler& phaseProfiler() {
+        static PhaseProfiler profiler{};
+        return profiler;
+    }
+
+#ifdef COSMO_PROFILE_PHASES
+    inline constexpr bool PHASE_PROFILING{ true };
+
+    class PhaseTimer;
+
+    // What the calling thread is currently timing.
+    struct PhaseContext {
+        PhaseProfiler::ThreadTotals::Operation* operation{};
+        PhaseTimer* timer{};
+    };
+
+    inline PhaseContext& phaseContext() {
+        thread_local PhaseContext context{};
+        return context;
+    }
+
+    // Times a read or write and owns the phases timed inside it. Nested operations, such as the
+    // storage write under Cosmo::put, fold into the outermost one.
+    class PhaseOperation {
+    public:
+        explicit PhaseOperation(PhaseOp op) {
+            auto& context = phaseContext();
+            if (!context.operation) {
+                _operation = &phaseProfiler().local().operations[static_cast<size_t>(op)];
+                context.operation = _operation;
+                _start = PhaseProfiler::ticks();
+            }
+        }
+
+        PhaseOperation(const PhaseOperation&) = delete;
+        PhaseOperation& operator=(const PhaseOperation&) = delete;
+
+        ~PhaseOperation() {
+            if (_operation) {
+                PhaseProfiler::add(_operation->total, PhaseProfiler::ticks() - _start);
+                PhaseProfiler::add(_operation->operations, 1);
+                phaseContext().operation = nullptr;
+            }
+        }
+
+    private:
+        PhaseProfiler::ThreadTotals::Operation* _operation{};
+        uint64_t _start{};
+    };
+
+    // Times one phase of the enclosing PhaseOperation, less the phases nested in it. Outside of
+    // an operation it does nothing.
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(Phase phase) : _phase{ phase } {
+            auto& context = phaseContext();
+            if (context.operation) {
+                _operation = context.operation;
+                _parent = std::exchange(context.timer, this);
+                _start = PhaseProfiler::ticks();
+            }
+        }
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+        ~PhaseTimer() {
+            if (!_operation) {
+                return;
+            }
+
+            auto elapsed = PhaseProfiler::ticks() - _start;
+            PhaseProfiler::add(_operation->phases[static_cast<size_t>(_phase)], elapsed - std::min(elapsed, _nested));
+
+            if (_parent) {
+                _parent->_nested += elapsed;
+            }
+            phaseContext().timer = _parent;
+        }
+
+    private:
+        Phase _phase{};
+        PhaseProfiler::ThreadTotals::Operation* _operation{};
+        PhaseTimer* _parent{};
+        uint64_t _start{};
+        uint64_t _nested{};
+    };
+#else
+    inline constexpr bool PHASE_PROFILING{ false };
+
+    // Without COSMO_PROFILE_PHASES operations and phases are not timed.
+    class PhaseOperation {
+    public:
+        explicit PhaseOperation(PhaseOp) {}
+    };
+
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(Phase) {}
+    };
+#endif
+
+    // Acquires a lock, counting the time until it is held as lock wait.
+    template<template<typename...> typename Lock, typename Mutex>
+    Lock<Mutex> lockTimed(Mutex& mutex) {
+        PhaseTimer timer{ Phase::LockWait };
+        return Lock<Mutex>{ mutex };
+    }
+}
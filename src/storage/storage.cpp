@@ -3,7 +3,10 @@
 
 #include "storage_strategy/basic_storage_strategy.hpp"
 #include "storage_strategy/buffered_storage_strategy.hpp"
+#include "log/logger.hpp"
+#include "trace/probes.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <fmt/format.h>
 #include <iostream>
@@ -11,46 +14,297 @@
 #include <memory>
 
 namespace cosmo::storage{
-    Storage::Storage(const fs::path& directory_path, data_file_size_t max_data_file_size):
+    Storage::Storage(const fs::path& directory_path, data_file_size_t max_data_file_size, StorageStrategyKind strategy):
         _storage_directory{ directory_path }, _max_data_file_size{ max_data_file_size } {
 
         if (!_storage_directory.exists() || !_storage_directory.is_directory()) {
             throw std::invalid_argument("the path provided is not valid");
         }
 
-        _data_files.reserve(DEFAULT_MAX_DATA_FILE_NUMBER);
         auto existing_data_files = seachFiles(_storage_directory, DATAFILE_PREFIX);
-        std::ranges::copy(existing_data_files, std::back_inserter(_data_files));
-        _active_file_id = static_cast<data_file_id_t>(_data_files.size());
+        std::ranges::sort(existing_data_files, [](const fs::path& lhs, const fs::path& rhs) {
+            auto lhs_name = lhs.filename().string();
+            auto rhs_name = rhs.filename().string();
+            return std::pair{ lhs_name.size(), lhs_name } < std::pair{ rhs_name.size(), rhs_name };
+        });
+        for (const auto& data_file : existing_data_files) {
+            auto segment = std::make_shared<ConcurrentFile>(data_file);
+            _sealed_bytes += segment->size();
+            _data_files.append(std::move(segment));
+        }
+        _active_file_id = static_cast<data_file_id_t>(existing_data_files.size());
+
+        for (data_file_id_t id = 0; id < _active_file_id; ++id) {
+            std::error_code ec{};
+            auto hint_size = fs::file_size(getHintFilePath(id), ec);
+            _sealed_bytes += ec ? 0 : hint_size;
+        }
+        _first_unsynced_file = _active_file_id;
+
+        _active_data_file_stream = ConcurrentFile{ directory_path / getActiveFileName(_active_file_id) };
+        if (strategy == StorageStrategyKind::Basic) {
+            _store = std::make_unique<BasicStorageStrategy>();
+        }
+        else {
+            _store = std::make_unique<BufferedStorageStrategy>(max_data_file_size);
+        }
 
-        _active_data_file_stream = ConcurrentFile{ directory_path / getActiveFileName() };
-        _store = std::make_unique<BufferedStorageStrategy>(max_data_file_size);
+        _active_file_size = fs::file_size(_active_data_file_stream.getPath());
+    }
 
-        _active_file_size = static_cast<data_file_size_t>(fs::file_size(_active_data_file_stream.getPath()));
+    Storage::~Storage() {
+        flush();
     }
 
     ReadResult Storage::read(data_file_id_t file_id, offset_t pos, data_file_size_t size) {
-        return _store->read(*this, file_id, pos, size);
+        return read(nullptr, file_id, pos, size);
+    }
+
+    ReadResult Storage::read(const SegmentTable::Snapshot& data_files, data_file_id_t file_id, offset_t pos, data_file_size_t size) {
+        return read(&data_files, file_id, pos, size);
+    }
+
+    ReadResult Storage::read(const SegmentTable::Snapshot* data_files, data_file_id_t file_id, offset_t pos, data_file_size_t size) {
+        PhaseOperation operation{ PhaseOp::Read };
+        COSMO_PROBE3(read_start, file_id, pos, size);
+
+        auto start = LatencyRecorder::Clock::now();
+        auto result = data_files && file_id < data_files->size() ?
+            (*data_files)[file_id].read(pos, size) :
+            _store->read(*this, file_id, pos, size);
+        _latencies.record(LatencyOp::Read, start);
+
+        COSMO_PROBE3(read_done, file_id, size, result.has_value());
+
+        if (!result) {
+            sharedLogger().log(LogLevel::Error, LogEvent::ReadFailed, "reading {} bytes at {} of file {} failed: {}",
+                size, pos, file_id, ErrorText{ result.error() });
+        }
+
+        return result;
+    }
+
+    WriteResult Storage::write(std::string_view value) {
+        PhaseOperation operation{ PhaseOp::Write };
+        auto start = beginWrite(value.size());
+        IoSlice slice{ value.data(), value.size() };
+        return finishWrite(_store->write(*this, { &slice, 1 }), start);
+    }
+
+    WriteResult Storage::write(std::span<const std::byte> value) {
+        PhaseOperation operation{ PhaseOp::Write };
+        auto start = beginWrite(value.size());
+        IoSlice slice{ reinterpret_cast<const char*>(value.data()), value.size() };
+        return finishWrite(_store->write(*this, { &slice, 1 }), start);
+    }
+
+    WriteResult Storage::writeOwned(std::string&& value) {
+        PhaseOperation operation{ PhaseOp::Write };
+        auto start = beginWrite(value.size());
+        return finishWrite(_store->write(*this, OwnedBuffer{ std::move(value) }), start);
+    }
+
+    WriteResult Storage::writeOwned(OwnedBuffer&& value) {
+        PhaseOperation operation{ PhaseOp::Write };
+        auto start = beginWrite(value.size());
+        return finishWrite(_store->write(*this, std::move(value)), start);
     }
 
-    WriteResult Storage::write(const std::string& value) {
-        return _store->write(*this, value);
+    WriteResult Storage::write(std::span<const IoSlice> slices) {
+        PhaseOperation operation{ PhaseOp::Write };
+        auto start = beginWrite(totalSize(slices));
+        return finishWrite(_store->write(*this, slices), start);
     }
 
-    void Storage::switchActiveDataFile() {
-        auto old_active_file_path = _active_data_file_stream.getPath();
-        ConcurrentFile new_active_data_file_stream{ _storage_directory.path() / getActiveFileName() };
-        _active_data_file_stream = std::move(new_active_data_file_stream);
-        auto new_data_file_name = _storage_directory.path() / getDataFileName(_active_file_id - 1);
-        fs::rename(old_active_file_path, new_data_file_name);
-        _data_files.emplace_back(new_data_file_name);
+    Result<void> Storage::flush() {
+        auto result = _store->flush(*this);
+
+        if (!result) {
+            sharedLogger().log(LogLevel::Error, LogEvent::FlushFailed, "flushing {} failed: {}",
+                getActiveFilePath(), ErrorText{ result.error() });
+        }
+
+        return result;
+    }
+
+    Result<void> Storage::sync() {
+        auto start = LatencyRecorder::Clock::now();
+        auto result = _store->sync(*this);
+        _latencies.record(LatencyOp::Fsync, start);
+
+        if (!result) {
+            sharedLogger().log(LogLevel::Error, LogEvent::FlushFailed, "syncing {} failed: {}",
+                getActiveFilePath(), ErrorText{ result.error() });
+        }
+
+        return result;
+    }
+
+    LatencyRecorder::Clock::time_point Storage::beginWrite([[maybe_unused]] size_t size) const {
+        COSMO_PROBE1(write_start, size);
+
+        return LatencyRecorder::Clock::now();
+    }
+
+    WriteResult Storage::finishWrite(WriteResult result, LatencyRecorder::Clock::time_point start) {
+        _latencies.record(LatencyOp::Write, start);
+
+        COSMO_PROBE3(write_done, result ? result->file_id : 0, result ? result->pos : 0, result.has_value());
+
+        if (!result) {
+            sharedLogger().log(LogLevel::Error, LogEvent::WriteFailed, "appending to {} failed: {}",
+                _storage_directory.path(), ErrorText{ result.error() });
+        }
+
+        return result;
     }
 
-    std::string Storage::getActiveFileName() const {
-        return fmt::format("{}_{}{}", ACTIVE_FILE_PREFIX, _active_file_id, FILE_EXTENSION);
+    Result<void> Storage::replaceDataFile(data_file_id_t file_id, ConcurrentFile&& merged_file) {
+        auto data_files = _data_files.load();
+        const auto& data_file = data_files.at(file_id);
+        auto data_file_path = data_file.getPath();
+        auto data_file_size = data_file.size();
+
+        if (auto renamed = merged_file.rename(data_file_path); !renamed) {
+            return renamed;
+        }
+
+        _sealed_bytes += merged_file.size();
+        _sealed_bytes -= data_file_size;
+        _data_files.replace(file_id, std::make_shared<ConcurrentFile>(std::move(merged_file)));
+        return {};
+    }
+
+    Result<void> Storage::removeHintFile(data_file_id_t file_id) {
+        auto hint_file_path = getHintFilePath(file_id);
+
+        std::error_code ec{};
+        auto hint_size = fs::file_size(hint_file_path, ec);
+        if (ec) {
+            hint_size = 0;
+        }
+
+        if (fs::remove(hint_file_path, ec); ec) {
+            return ec;
+        }
+
+        _sealed_bytes -= hint_size;
+        return {};
+    }
+
+    Result<void> Storage::installHintFile(data_file_id_t file_id, const fs::path& hint_file, uint64_t size) {
+        std::error_code ec{};
+        if (fs::rename(hint_file, getHintFilePath(file_id), ec); ec) {
+            return ec;
+        }
+
+        _sealed_bytes += size;
+        return {};
+    }
+
+    Result<void> Storage::syncDirectory() {
+        _io.add(IoCounter::Fsyncs, 1);
+        return native::syncDirectory(_storage_directory.path());
+    }
+
+    Result<void> Storage::truncateActiveFile(data_file_size_t size) {
+        if (auto flushed = flush(); !flushed) {
+            return flushed;
+        }
+
+        if (auto truncated = _active_data_file_stream.truncate(size); !truncated) {
+            return truncated;
+        }
+
+        _active_file_size = size;
+        return {};
+    }
+
+    Result<void> Storage::switchActiveDataFile() {
+        COSMO_PROBE1(rollover_start, _active_file_id);
+
+        auto start = LatencyRecorder::Clock::now();
+        auto result = sealActiveFile();
+
+        if (result) {
+            _latencies.record(LatencyOp::Rollover, start);
+        }
+
+        COSMO_PROBE2(rollover_done, _active_file_id, result.has_value());
+
+        return result;
+    }
+
+    Result<void> Storage::sealActiveFile() {
+        auto next_active_file = ConcurrentFile::open(_storage_directory.path() / getActiveFileName(_active_file_id + 1));
+        if (!next_active_file) {
+            return next_active_file.error();
+        }
+
+        // The full active file keeps its handle and becomes the newest immutable segment.
+        if (auto renamed = _active_data_file_stream.rename(_storage_directory.path() / getDataFileName(_active_file_id)); !renamed) {
+            return renamed;
+        }
+
+        _data_files.append(std::make_shared<ConcurrentFile>(std::move(_active_data_file_stream)));
+        _active_data_file_stream = std::move(*next_active_file);
+        _active_file_id++;
+        _sealed_bytes += _active_file_size.exchange(0);
+
+        return {};
+    }
+
+    Result<void> Storage::syncFiles() {
+        auto data_files = _data_files.load();
+
+        for (; _first_unsynced_file < data_files.size(); ++_first_unsynced_file) {
+            _io.add(IoCounter::Fsyncs, 1);
+
+            COSMO_PROBE1(fsync_start, _first_unsynced_file);
+            auto synced = data_files[_first_unsynced_file].sync();
+            COSMO_PROBE2(fsync_done, _first_unsynced_file, synced.has_value());
+
+            if (!synced) {
+                return synced;
+            }
+        }
+
+        _io.add(IoCounter::Fsyncs, 1);
+
+        COSMO_PROBE1(fsync_start, _active_file_id);
+        auto synced = _active_data_file_stream.sync();
+        COSMO_PROBE2(fsync_done, _active_file_id, synced.has_value());
+
+        return synced;
+    }
+
+    IoStats Storage::getIoStats() const {
+        IoStats stats{
+            _io.get(IoCounter::UserBytesWritten),
+            _io.get(IoCounter::DataBytesWritten),
+            _io.get(IoCounter::MergeBytesWritten),
+            _io.get(IoCounter::HintBytesWritten),
+            _io.get(IoCounter::MergeBytesRead),
+            _io.get(IoCounter::Fsyncs),
+            _sealed_bytes.load() + _active_file_size.load(),
+        };
+
+        return stats;
+    }
+
+    std::string Storage::getActiveFileName(data_file_id_t id) const {
+        return fmt::format("{}_{}{}", ACTIVE_FILE_PREFIX, id, FILE_EXTENSION);
     }
 
     std::string Storage::getDataFileName(data_file_id_t id) const {
         return fmt::format("{}_{}{}", DATAFILE_PREFIX, id, FILE_EXTENSION);
     }
+
+    fs::path Storage::getHintFilePath(data_file_id_t id) const {
+        return _storage_directory.path() / fmt::format("{}_{}{}", HINTFILE_PREFIX, id, FILE_EXTENSION);
+    }
+
+    fs::path Storage::getMergeFilePath(data_file_id_t id) const {
+        return _storage_directory.path() / fmt::format("{}_{}{}", MERGEFILE_PREFIX, id, FILE_EXTENSION);
+    }
 };
\ No newline at end of file
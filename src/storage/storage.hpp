@@ -2,6 +2,8 @@
 
 #include "utils/storage_utils.hpp"
 #include "storage_strategy/storage_strategy.hpp"
+#include "stats/io_stats.hpp"
+#include "stats/latency.hpp"
 
 #include <atomic>
 #include <ranges>
@@ -10,7 +12,9 @@
 #include <fstream>
 #include <memory>
 #include <optional>
+#include <span>
 #include <stdexcept>
+#include <string_view>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -18,40 +22,112 @@ namespace fs = std::filesystem;
 namespace cosmo::storage {
     class Storage {
     public:
-        explicit Storage(const fs::path& directory_path, data_file_size_t max_data_file_size = DEFAULT_MAX_DATA_FILE_SIZE);
+        explicit Storage(const fs::path& directory_path, data_file_size_t max_data_file_size = DEFAULT_MAX_DATA_FILE_SIZE,
+            StorageStrategyKind strategy = StorageStrategyKind::Buffered);
+
+        ~Storage();
 
         ReadResult read(data_file_id_t file_id, offset_t pos, data_file_size_t size);
 
-        WriteResult write(const std::string& value);
+        // Reads immutable files through a snapshot taken earlier, which keeps them alive and
+        // unchanged whatever merge replaced since.
+        ReadResult read(const SegmentTable::Snapshot& data_files, data_file_id_t file_id, offset_t pos, data_file_size_t size);
+
+        WriteResult write(std::string_view value);
+
+        WriteResult write(std::span<const std::byte> value);
+
+        // Takes ownership of the value instead of copying it; it is released once written out.
+        // Named apart from write() so string literals keep converting to std::string_view.
+        WriteResult writeOwned(std::string&& value);
+
+        WriteResult writeOwned(OwnedBuffer&& value);
+
+        // Appends the slices back to back as one value and returns the position of the first byte.
+        WriteResult write(std::span<const IoSlice> slices);
+
+        Result<void> flush();
+
+        // Flushes pending writes and forces them, and every file sealed since the last sync, to disk.
+        Result<void> sync();
+
+        // Renames a merged file over a data file, keeping its handle. The merged file must already
+        // be synced, and the rename is durable only after syncDirectory().
+        Result<void> replaceDataFile(data_file_id_t file_id, ConcurrentFile&& merged_file);
+
+        // Removes the hint of a data file, if it has one. Durable only after syncDirectory().
+        Result<void> removeHintFile(data_file_id_t file_id);
+
+        // Renames a written hint of size bytes into place for a data file. Durable only after syncDirectory().
+        Result<void> installHintFile(data_file_id_t file_id, const fs::path& hint_file, uint64_t size);
+
+        // Makes renames and removals in the storage directory durable.
+        Result<void> syncDirectory();
+
+        // Cuts a torn tail off the active file during recovery, before any write is accepted.
+        Result<void> truncateActiveFile(data_file_size_t size);
             
-        const std::vector<ConcurrentFile>& getDataFiles() const { return _data_files; };
+        SegmentTable::Snapshot getDataFiles() const { return _data_files.load(); };
             
         bool isActiveFileOpen() const { return _active_data_file_stream.isOpen(); };
 
         const fs::directory_entry& getStorageDirectory() const { return _storage_directory; }
 
+        const fs::path& getActiveFilePath() const { return _active_data_file_stream.getPath(); }
+
+        fs::path getHintFilePath(data_file_id_t id) const;
+
+        fs::path getMergeFilePath(data_file_id_t id) const;
+
         data_file_id_t getActiveFileId() const { return _active_file_id; }
 
         data_file_size_t getActiveFileSize() const { return _active_file_size.load(); }
 
         data_file_size_t getMaxDataFileSize() const { return _max_data_file_size; }
 
+        LatencyStats getStats() const { return _latencies.stats(); }
+
+        Histogram getLatencies(LatencyOp op) const { return _latencies.snapshot(op); }
+
+        BufferFill getBufferFill() const { return _store->bufferFill(); }
+
+        void recordLatency(LatencyOp op, LatencyRecorder::Clock::time_point start) { _latencies.record(op, start); }
+
+        IoStats getIoStats() const;
+
+        void recordIo(IoCounter counter, uint64_t amount) { _io.add(counter, amount); }
+
     private:
-        std::string getActiveFileName() const;
+        ReadResult read(const SegmentTable::Snapshot* data_files, data_file_id_t file_id, offset_t pos, data_file_size_t size);
+        std::string getActiveFileName(data_file_id_t id) const;
         std::string getDataFileName(data_file_id_t id) const;
-        void switchActiveDataFile();
+        // Seals the active file as the next data file and opens a fresh one; callers hold the strategy lock.
+        Result<void> switchActiveDataFile();
+        Result<void> sealActiveFile();
+        // Syncs the files sealed since the last call, then the active file; callers hold the strategy lock.
+        Result<void> syncFiles();
+        LatencyRecorder::Clock::time_point beginWrite(size_t size) const;
+        WriteResult finishWrite(WriteResult result, LatencyRecorder::Clock::time_point start);
 
         fs::directory_entry _storage_directory{};
-        std::vector<ConcurrentFile> _data_files{};
+        SegmentTable _data_files{};
         ConcurrentFile _active_data_file_stream{};
         data_file_id_t _active_file_id{};
         std::atomic<data_file_size_t> _active_file_size{};
+        // Size of the sealed data files and their hints, kept up to date as they change so stats
+        // never have to stat them.
+        std::atomic<uint64_t> _sealed_bytes{};
         data_file_size_t _max_data_file_size{};
+        data_file_id_t _first_unsynced_file{};
 
         std::unique_ptr<IStorageStrategy> _store;
+        LatencyRecorder _latencies{};
+        IoCounters _io{};
 
         inline static const std::string ACTIVE_FILE_PREFIX{ "activefile" };
         inline static const std::string DATAFILE_PREFIX{ "datafile" };
+        inline static const std::string HINTFILE_PREFIX{ "hintfile" };
+        inline static const std::string MERGEFILE_PREFIX{ "mergefile" };
         inline static const std::string FILE_EXTENSION{ ".cosmo" };
 
         static const data_file_size_t DEFAULT_MAX_DATA_FILE_SIZE{ 1'000'000'000 };
@@ -9,37 +9,69 @@ namespace cosmo::storage {
     class BasicStorageStrategy : public IStorageStrategy {
         public:
             ReadResult read(Storage& storage, data_file_id_t file_id, offset_t pos, data_file_size_t size) override {
-                std::shared_lock lck{ _mtx };
+                auto data_files = storage._data_files.load();
+
+                if (file_id < data_files.size()) {
+                    return data_files[file_id].read(pos, size);
+                }
+
+                auto lck = lockTimed<std::shared_lock>(_mtx);
 
                 if (file_id == storage._active_file_id) {
                     return storage._active_data_file_stream.read(pos, size);
                 }
                 else {
-                    return storage._data_files.at(file_id).read(pos, size);
+                    // Sealed since the snapshot above was taken, or no file of this storage at all.
+                    data_files = storage._data_files.load();
+                    if (file_id >= data_files.size()) {
+                        return std::make_error_code(std::errc::invalid_argument);
+                    }
+
+                    return data_files[file_id].read(pos, size);
                 }
             }
 
-            WriteResult write(Storage& storage, const std::string& value) override {
-                std::unique_lock lck{ _mtx };
+            WriteResult write(Storage& storage, std::span<const IoSlice> slices) override {
+                auto lck = lockTimed<std::unique_lock>(_mtx);
 
                 if (storage._active_file_size.load() >= storage._max_data_file_size) {
-                    storage._active_file_id++;
-                    storage.switchActiveDataFile();
-                    storage._active_file_size = 0;
+                    if (auto switched = storage.switchActiveDataFile(); !switched) {
+                        return switched.error();
+                    }
                 }
 
                 auto file_id = storage._active_file_id;
 
                 lck.unlock();
 
-                auto [status, pos] = storage._active_data_file_stream.write(value.c_str(), value.size());
-                auto value_size = status ? static_cast<data_file_size_t>(value.size()) : 0;
+                auto pos = storage._active_data_file_stream.write(slices);
+                if (!pos) {
+                    return pos.error();
+                }
+
+                auto value_size = totalSize(slices);
                 storage._active_file_size += value_size;
+                storage._io.add(IoCounter::DataBytesWritten, value_size);
+
+                return WriteLocation{ file_id, *pos };
+            }
+
+            WriteResult write(Storage& storage, OwnedBuffer&& value) override {
+                auto slice = value.slice();
+                return write(storage, { &slice, 1 });
+            }
+
+            Result<void> flush(Storage&) override {
+                return {};
+            }
+
+            Result<void> sync(Storage& storage) override {
+                std::unique_lock lck{ _mtx };
 
-                return { status, file_id, pos }; 
+                return storage.syncFiles();
             }
 
         private:
-            std::shared_mutex _mtx;
+            ProfiledMutex<std::shared_mutex> _mtx{ LockSite::Strategy };
     };
 }
\ No newline at end of file
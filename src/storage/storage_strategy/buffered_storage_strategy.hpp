@@ -3,55 +3,345 @@
 #include "storage_strategy.hpp"
 
 #include <storage.hpp>
+#include <trace/probes.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <shared_mutex>
-#include <string> 
+#include <string>
+#include <vector>
 
 namespace cosmo::storage {
     class BufferedStorageStrategy : public IStorageStrategy {
     public:
-        explicit BufferedStorageStrategy(size_t max_buffer_size) {
-            _buffer.reserve(max_buffer_size);
+        // The buffer starts empty and grows on demand up to max_buffer_size, as far as the memory budget allows.
+        explicit BufferedStorageStrategy(size_t max_buffer_size, size_t direct_write_threshold = DEFAULT_DIRECT_WRITE_THRESHOLD) :
+            _direct_write_threshold{ direct_write_threshold }, _buffer_capacity{ max_buffer_size } {}
+
+        ~BufferedStorageStrategy() override {
+            memoryBudget().release(MemoryComponent::WriteBuffer, _buffer_charged + _owned_charged);
         }
 
-        
+        static constexpr size_t DEFAULT_DIRECT_WRITE_THRESHOLD{ 32 * 1024 };
+        static constexpr size_t MIN_BUFFER_SIZE{ 64 * 1024 };
+
+
         ReadResult read(Storage& storage, data_file_id_t file_id, offset_t pos, data_file_size_t size) override {
-            std::shared_lock lck{ _mtx };
+            auto data_files = storage._data_files.load();
+
+            if (file_id < data_files.size()) {
+                return data_files[file_id].read(pos, size);
+            }
+
+            auto lck = lockTimed<std::shared_lock>(_mtx);
 
             if (file_id == storage._active_file_id) {
-                return storage._active_data_file_stream.read(pos, size);   //should read from the buffer will be fixed
+                auto pending_start = storage._active_file_size.load() - _pending_size;
+
+                if (pos < pending_start) {
+                    return storage._active_data_file_stream.read(pos, size);
+                }
+
+                auto buffer = sharedReadBuffer().getBuffer(size);
+
+                if (!buffer) {
+                    return std::make_error_code(std::errc::not_enough_memory);
+                }
+
+                PhaseTimer timer{ Phase::Copy };
+                readPending(buffer, static_cast<size_t>(pos - pending_start), size);
+
+                return buffer;
+            }
+            else {
+                // Sealed since the snapshot above was taken, or no file of this storage at all.
+                data_files = storage._data_files.load();
+                if (file_id >= data_files.size()) {
+                    return std::make_error_code(std::errc::invalid_argument);
+                }
+
+                return data_files[file_id].read(pos, size);
+            }
+        }
+
+        WriteResult write(Storage& storage, std::span<const IoSlice> slices) override {
+            auto lck = lockTimed<std::unique_lock>(_mtx);
+
+            auto value_size = totalSize(slices);
+
+            if (auto prepared = prepareWrite(storage, value_size); !prepared) {
+                return prepared.error();
+            }
+
+            auto file_id = storage._active_file_id;
+
+            offset_t pos = storage._active_file_size.load();
+
+            if (value_size >= _direct_write_threshold) {
+                // Large values skip the buffer: pending bytes and the caller's slices go out in one gather write.
+                if (auto flushed = flushPending(storage, slices); !flushed) {
+                    return flushed.error();
+                }
             }
             else {
-                return storage._data_files.at(file_id).read(pos, size);
+                auto reserved = reserve(storage, value_size, false);
+                if (!reserved) {
+                    return reserved.error();
+                }
+
+                if (!*reserved) {
+                    if (auto flushed = flushPending(storage, slices); !flushed) {
+                        return flushed.error();
+                    }
+
+                    storage._active_file_size += value_size;
+                    return WriteLocation{ file_id, pos };
+                }
+
+                PhaseTimer timer{ Phase::Copy };
+
+                if (_pending.empty() || _pending.back().owner) {
+                    _pending.push_back({ _buffer.size(), 0, {} });
+                }
+
+                for (const auto& slice : slices) {
+                    _buffer.append(slice.data, slice.size);
+                }
+
+                _pending.back().size += value_size;
+                _pending_size += value_size;
             }
+
+            storage._active_file_size += value_size;
+
+            lck.unlock();
+
+            return WriteLocation{ file_id, pos };
         }
 
-        WriteResult write(Storage& storage, const std::string& value) override {
-            std::unique_lock lck {_mtx};
+        WriteResult write(Storage& storage, OwnedBuffer&& value) override {
+            auto lck = lockTimed<std::unique_lock>(_mtx);
+
+            auto value_size = value.size();
 
-            if (_buffer.size() + value.size() > _buffer.capacity()) {
-                storage._active_file_id++;
-                storage._active_data_file_stream.write(_buffer.data(), _buffer.size());
-                _buffer.clear();
-                storage.switchActiveDataFile();
+            if (auto prepared = prepareWrite(storage, value_size); !prepared) {
+                return prepared.error();
             }
 
             auto file_id = storage._active_file_id;
 
-            auto pos = _buffer.size();
+            offset_t pos = storage._active_file_size.load();
+
+            if (value_size >= _direct_write_threshold) {
+                auto slice = value.slice();
+                if (auto flushed = flushPending(storage, { &slice, 1 }); !flushed) {
+                    return flushed.error();
+                }
+            }
+            else {
+                auto reserved = reserve(storage, value_size, true);
+                if (!reserved) {
+                    return reserved.error();
+                }
+
+                if (!*reserved) {
+                    auto slice = value.slice();
+                    if (auto flushed = flushPending(storage, { &slice, 1 }); !flushed) {
+                        return flushed.error();
+                    }
 
-            _buffer.append(value);
+                    storage._active_file_size += value_size;
+                    return WriteLocation{ file_id, pos };
+                }
+
+                // The buffer is queued as is and released by the flush that writes it out.
+                _pending.push_back({ 0, value_size, std::move(value) });
+                _pending_size += value_size;
+            }
+
+            storage._active_file_size += value_size;
 
             lck.unlock();
 
-            return { true, file_id, pos };
+            return WriteLocation{ file_id, pos };
+        }
+
+        Result<void> flush(Storage& storage) override {
+            std::unique_lock lck{ _mtx };
+
+            return flushPending(storage);
+        }
+
+        Result<void> sync(Storage& storage) override {
+            std::unique_lock lck{ _mtx };
+
+            if (auto flushed = flushPending(storage); !flushed) {
+                return flushed;
+            }
+
+            return storage.syncFiles();
+        }
+
+        BufferFill bufferFill() const override {
+            return { _pending_size.load(std::memory_order_relaxed), _buffer_capacity };
         }
 
     private:
-        std::shared_mutex _mtx;
+        // Unflushed bytes of the active file, in file order: either a run of _buffer or an adopted buffer.
+        struct PendingChunk {
+            size_t buffer_offset{};
+            size_t size{};
+            OwnedBuffer owner{};
+        };
+
+        ProfiledMutex<std::shared_mutex> _mtx{ LockSite::Strategy };
         std::string _buffer{};
+        std::vector<PendingChunk> _pending{};
+        // Atomic only so bufferFill() can read it without the lock.
+        std::atomic<size_t> _pending_size{};
+        size_t _direct_write_threshold{};
+        size_t _buffer_capacity{};
+        // Memory budget charged for the capacity of _buffer and for adopted buffers still pending.
+        size_t _buffer_charged{};
+        size_t _owned_charged{};
+
+        const char* chunkData(const PendingChunk& chunk) const {
+            return chunk.owner ? chunk.owner.data() : _buffer.data() + chunk.buffer_offset;
+        }
+
+        Result<void> prepareWrite(Storage& storage, size_t value_size) {
+            auto active_file_size = storage._active_file_size.load();
+
+            if (active_file_size > 0 && active_file_size + value_size > storage._max_data_file_size) {
+                if (auto flushed = flushPending(storage); !flushed) {
+                    return flushed;
+                }
+
+                return storage.switchActiveDataFile();
+            }
+
+            return {};
+        }
+
+        // Makes room for value_size more pending bytes, flushing the buffer when it is full. False
+        // means the memory budget leaves no room even in an empty buffer and the value has to be
+        // written directly.
+        Result<bool> reserve(Storage& storage, size_t value_size, bool owned) {
+            PhaseTimer timer{ Phase::BufferReserve };
+
+            if (_pending_size + value_size <= _buffer_capacity && charge(value_size, owned)) {
+                return true;
+            }
+
+            if (auto flushed = flushPending(storage); !flushed) {
+                return flushed.error();
+            }
+
+            return charge(value_size, owned);
+        }
+
+        bool charge(size_t value_size, bool owned) {
+            if (owned) {
+                if (!memoryBudget().tryReserve(MemoryComponent::WriteBuffer, value_size)) {
+                    return false;
+                }
+
+                _owned_charged += value_size;
+                return true;
+            }
+
+            auto needed = _buffer.size() + value_size;
+            if (needed <= _buffer_charged) {
+                return true;
+            }
+
+            // Grow geometrically, or only as far as needed when the budget is tight.
+            for (auto target : { std::min(_buffer_capacity, std::max({ needed, _buffer_charged * 2, MIN_BUFFER_SIZE })), needed }) {
+                if (memoryBudget().tryReserve(MemoryComponent::WriteBuffer, target - _buffer_charged)) {
+                    _buffer.reserve(target);
+
+                    // The allocator may round up; what it handed out is charged either way.
+                    memoryBudget().reserve(MemoryComponent::WriteBuffer, _buffer.capacity() - std::min(_buffer.capacity(), target));
+                    _buffer_charged = std::max(_buffer.capacity(), target);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Returns the budget of the adopted buffers just flushed and, under memory pressure, hands
+        // the memory of the emptied buffer back too; it grows again on demand.
+        void releaseFlushed() {
+            memoryBudget().release(MemoryComponent::WriteBuffer, _owned_charged);
+            _owned_charged = 0;
+
+            if (_buffer_charged > 0 && memoryBudget().underPressure()) {
+                std::string{}.swap(_buffer);
+                memoryBudget().release(MemoryComponent::WriteBuffer, _buffer_charged);
+                _buffer_charged = 0;
+            }
+        }
+
+        void readPending(char* out, size_t offset, size_t size) const {
+            for (const auto& chunk : _pending) {
+                if (size == 0) {
+                    break;
+                }
+
+                if (offset >= chunk.size) {
+                    offset -= chunk.size;
+                    continue;
+                }
+
+                auto count = std::min(size, chunk.size - offset);
+                std::memcpy(out, chunkData(chunk) + offset, count);
+
+                out += count;
+                size -= count;
+                offset = 0;
+            }
+        }
+
+        Result<void> flushPending(Storage& storage, std::span<const IoSlice> trailing = {}) {
+            if (_pending.empty() && trailing.empty()) {
+                return {};
+            }
+
+            std::vector<IoSlice> slices{};
+            slices.reserve(_pending.size() + trailing.size());
+
+            for (const auto& chunk : _pending) {
+                slices.push_back({ chunkData(chunk), chunk.size });
+            }
+            slices.insert(slices.end(), trailing.begin(), trailing.end());
+
+            auto bytes = totalSize(slices);
+            COSMO_PROBE1(flush_start, bytes);
+
+            // Timed here rather than in Storage::flush(), so the flushes writes trigger themselves count too.
+            auto start = LatencyRecorder::Clock::now();
+            auto pos = storage._active_data_file_stream.write(slices);
+            storage._latencies.record(LatencyOp::Flush, start);
+
+            COSMO_PROBE2(flush_done, bytes, pos.has_value());
+
+            if (!pos) {
+                return pos.error();
+            }
+
+            storage._io.add(IoCounter::DataBytesWritten, bytes);
+
+            _buffer.clear();
+            _pending.clear();
+            _pending_size = 0;
+
+            releaseFlushed();
+
+            return {};
+        }
     };
 
 
 }
-
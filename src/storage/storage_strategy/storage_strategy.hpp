@@ -6,10 +6,26 @@
 namespace cosmo::storage {
 	class Storage;
 
+	enum class StorageStrategyKind : uint8_t {
+		Basic = 0,
+		Buffered = 1,
+	};
+
+	// Bytes waiting in the write buffer and its size; both 0 for unbuffered strategies.
+	struct BufferFill {
+		size_t used{};
+		size_t capacity{};
+	};
+
 	class IStorageStrategy {
 		public:
 			virtual ReadResult read(Storage& storage, data_file_id_t file_id, offset_t pos, data_file_size_t size) = 0;
-			virtual WriteResult write(Storage& storage, const std::string& value) = 0;
+			virtual WriteResult write(Storage& storage, std::span<const IoSlice> slices) = 0;
+			virtual WriteResult write(Storage& storage, OwnedBuffer&& value) = 0;
+			virtual Result<void> flush(Storage& storage) = 0;
+			virtual Result<void> sync(Storage& storage) = 0;
+			// Must not take the strategy lock; it backs monitoring.
+			virtual BufferFill bufferFill() const { return {}; }
 
 			virtual ~IStorageStrategy() = default;
 	};
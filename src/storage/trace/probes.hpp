@@ -0,0 +1,26 @@
+#pragma once
+
+// USDT tracepoints under the "cosmo" provider, built in with -DCOSMO_ENABLE_USDT=ON where
+// <sys/sdt.h> is available. An unattached probe is a single nop; list them with
+// `bpftrace -l 'usdt:/path/to/binary:cosmo:*'`.
+//
+//   read_start(file_id, pos, size)      read_done(file_id, size, ok)
+//   write_start(size)                   write_done(file_id, pos, ok)
+//   flush_start(bytes)                  flush_done(bytes, ok)
+//   rollover_start(file_id)             rollover_done(file_id, ok)
+//   fsync_start(file_id)                fsync_done(file_id, ok)
+//   merge_start(data_files)             merge_done(ok)
+//
+// file_id of fsync probes is the active file id for the active file.
+
+#if defined(COSMO_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+
+#define COSMO_PROBE1(name, a) DTRACE_PROBE1(cosmo, name, a)
+#define COSMO_PROBE2(name, a, b) DTRACE_PROBE2(cosmo, name, a, b)
+#define COSMO_PROBE3(name, a, b, c) DTRACE_PROBE3(cosmo, name, a, b, c)
+#else
+#define COSMO_PROBE1(name, a) do {} while (false)
+#define COSMO_PROBE2(name, a, b) do {} while (false)
+#define COSMO_PROBE3(name, a, b, c) do {} while (false)
+#endif
@@ -1,6 +1,28 @@
 #include "storage_utils.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <string_view>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 
 namespace cosmo::storage {
@@ -29,4 +51,272 @@ namespace cosmo::storage {
 
         return files;
     }
-}
\ No newline at end of file
+
+    namespace native {
+        namespace {
+            std::error_code lastError() {
+                return { errno, std::generic_category() };
+            }
+
+            // The whole pages inside [data, data + size), as a start and a length.
+            std::pair<char*, size_t> innerPages(char* data, size_t size, size_t page_size) {
+                auto begin = (reinterpret_cast<uintptr_t>(data) + page_size - 1) / page_size * page_size;
+                auto end = (reinterpret_cast<uintptr_t>(data) + size) / page_size * page_size;
+
+                if (end <= begin) {
+                    return { nullptr, 0 };
+                }
+                return { reinterpret_cast<char*>(begin), end - begin };
+            }
+        }
+
+#ifdef _WIN32
+        // Rollover renames the active file and merge replaces data files while they are open, which
+        // Windows only allows when every handle shares delete access; _wopen does not.
+        Result<handle_t> open(const fs::path& path) {
+            auto file = ::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) {
+                return std::error_code{ static_cast<int>(::GetLastError()), std::system_category() };
+            }
+
+            auto handle = ::_open_osfhandle(reinterpret_cast<intptr_t>(file), _O_RDWR | _O_BINARY);
+            if (handle == INVALID_HANDLE) {
+                ::CloseHandle(file);
+                return lastError();
+            }
+
+            return handle;
+        }
+
+        void close(handle_t handle) {
+            ::_close(handle);
+        }
+
+        Result<uint64_t> size(handle_t handle) {
+            auto length = ::_filelengthi64(handle);
+            if (length < 0) {
+                return lastError();
+            }
+            return static_cast<uint64_t>(length);
+        }
+
+        Result<void> truncate(handle_t handle, uint64_t size) {
+            if (auto error = ::_chsize_s(handle, static_cast<__int64>(size)); error != 0) {
+                return std::error_code{ error, std::generic_category() };
+            }
+            return {};
+        }
+
+        Result<void> sync(handle_t handle) {
+            if (::_commit(handle) != 0) {
+                return lastError();
+            }
+            return {};
+        }
+
+        Result<size_t> writeAt(handle_t handle, std::span<const IoSlice> slices, uint64_t offset) {
+            auto file = reinterpret_cast<HANDLE>(::_get_osfhandle(handle));
+            size_t written{};
+
+            for (const auto& slice : slices) {
+                size_t slice_written{};
+                while (slice_written < slice.size) {
+                    auto position = offset + written;
+                    OVERLAPPED overlapped{};
+                    overlapped.Offset = static_cast<DWORD>(position);
+                    overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+
+                    auto chunk = static_cast<DWORD>(std::min<size_t>(slice.size - slice_written, MAXDWORD));
+                    DWORD result{};
+                    if (!::WriteFile(file, slice.data + slice_written, chunk, &result, &overlapped)) {
+                        return std::error_code{ static_cast<int>(::GetLastError()), std::system_category() };
+                    }
+
+                    slice_written += result;
+                    written += result;
+                }
+            }
+
+            return written;
+        }
+
+        Result<void> readAt(handle_t handle, char* buffer, size_t size, uint64_t offset) {
+            auto file = reinterpret_cast<HANDLE>(::_get_osfhandle(handle));
+            size_t read{};
+
+            while (read < size) {
+                auto position = offset + read;
+                OVERLAPPED overlapped{};
+                overlapped.Offset = static_cast<DWORD>(position);
+                overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+
+                auto chunk = static_cast<DWORD>(std::min<size_t>(size - read, MAXDWORD));
+                DWORD result{};
+                if (!::ReadFile(file, buffer + read, chunk, &result, &overlapped)) {
+                    return std::error_code{ static_cast<int>(::GetLastError()), std::system_category() };
+                }
+                if (result == 0) {
+                    return std::make_error_code(std::errc::io_error);
+                }
+
+                read += result;
+            }
+
+            return {};
+        }
+
+        // NTFS journals renames itself, and a directory cannot be opened through the CRT to flush it.
+        Result<void> syncDirectory(const fs::path&) {
+            return {};
+        }
+
+        // Only a hint: resetting fails, harmlessly, on heap memory the allocator did not map on its own.
+        void discard(char* data, size_t size) {
+            static const size_t page_size = [] {
+                SYSTEM_INFO info{};
+                ::GetSystemInfo(&info);
+                return static_cast<size_t>(info.dwPageSize);
+            }();
+
+            if (auto [pages, length] = innerPages(data, size, page_size); length > 0) {
+                ::VirtualAlloc(pages, length, MEM_RESET, PAGE_READWRITE);
+            }
+        }
+#else
+        Result<handle_t> open(const fs::path& path) {
+            auto handle = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (handle == INVALID_HANDLE) {
+                return lastError();
+            }
+            return handle;
+        }
+
+        void close(handle_t handle) {
+            ::close(handle);
+        }
+
+        Result<uint64_t> size(handle_t handle) {
+            struct stat file_stat{};
+            if (::fstat(handle, &file_stat) != 0) {
+                return lastError();
+            }
+            return static_cast<uint64_t>(file_stat.st_size);
+        }
+
+        Result<void> truncate(handle_t handle, uint64_t size) {
+            if (::ftruncate(handle, static_cast<off_t>(size)) != 0) {
+                return lastError();
+            }
+            return {};
+        }
+
+        Result<void> sync(handle_t handle) {
+#ifdef __APPLE__
+            auto result = ::fsync(handle);
+#else
+            auto result = ::fdatasync(handle);
+#endif
+            if (result != 0) {
+                return lastError();
+            }
+            return {};
+        }
+
+        Result<size_t> writeAt(handle_t handle, std::span<const IoSlice> slices, uint64_t offset) {
+            constexpr size_t INLINE_SLICES{ 16 };
+
+            iovec inline_iov[INLINE_SLICES];
+            std::vector<iovec> heap_iov{};
+            iovec* iov = inline_iov;
+
+            if (slices.size() > INLINE_SLICES) {
+                heap_iov.resize(slices.size());
+                iov = heap_iov.data();
+            }
+
+            size_t count{};
+            for (const auto& slice : slices) {
+                if (slice.size > 0) {
+                    iov[count++] = { const_cast<char*>(slice.data), slice.size };
+                }
+            }
+
+            size_t written{};
+            size_t first{};
+
+            while (first < count) {
+                auto batch = static_cast<int>(std::min<size_t>(count - first, IOV_MAX));
+                auto result = ::pwritev(handle, iov + first, batch, static_cast<off_t>(offset + written));
+
+                if (result < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return lastError();
+                }
+
+                written += static_cast<size_t>(result);
+
+                auto remaining = static_cast<size_t>(result);
+                while (first < count && remaining >= iov[first].iov_len) {
+                    remaining -= iov[first].iov_len;
+                    ++first;
+                }
+                if (remaining > 0) {
+                    iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+                    iov[first].iov_len -= remaining;
+                }
+            }
+
+            return written;
+        }
+
+        Result<void> readAt(handle_t handle, char* buffer, size_t size, uint64_t offset) {
+            size_t read{};
+
+            while (read < size) {
+                auto result = ::pread(handle, buffer + read, size - read, static_cast<off_t>(offset + read));
+
+                if (result < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return lastError();
+                }
+                if (result == 0) {
+                    return std::make_error_code(std::errc::io_error);
+                }
+
+                read += static_cast<size_t>(result);
+            }
+
+            return {};
+        }
+
+        Result<void> syncDirectory(const fs::path& path) {
+            auto handle = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (handle < 0) {
+                return lastError();
+            }
+
+            auto result = ::fsync(handle);
+            auto error = lastError();
+            ::close(handle);
+
+            if (result != 0) {
+                return error;
+            }
+            return {};
+        }
+
+        void discard(char* data, size_t size) {
+            static const auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+            if (auto [pages, length] = innerPages(data, size, page_size); length > 0) {
+                ::madvise(pages, length, MADV_DONTNEED);
+            }
+        }
+#endif
+    }
+}
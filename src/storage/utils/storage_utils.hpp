@@ -1,5 +1,8 @@
 #pragma once
 
+#include "memory/memory_budget.hpp"
+#include "stats/lock_stats.hpp"
+#include "stats/phase_stats.hpp"
 
 #include <optional>
 #include <fstream>
@@ -8,143 +11,465 @@
 #include <vector>
 #include <mutex>
 #include <unordered_map>
-#include <iostream>
+#include <system_error>
 #include <shared_mutex>
 #include <functional>
 #include <atomic>
+#include <cerrno>
+#include <memory>
+#include <span>
+#include <utility>
+#include <algorithm>
 
 namespace fs = std::filesystem;
 
 namespace cosmo::storage {
-	using offset_t = std::streampos;
-	using data_file_size_t = uint32_t;
+	using offset_t = uint64_t;
+	using data_file_size_t = uint64_t;
 	using data_file_id_t = uint32_t;
 
-	using ReadResult = std::pair<bool, char*>;
-	using WriteResult = std::tuple<bool, data_file_id_t, offset_t>;
+	// Either a value or the error that kept it from being produced, shaped like C++23
+	// std::expected so callers can move over unchanged. The data path reports failures
+	// through it instead of throwing.
+	template <typename T>
+	class Result {
+	public:
+		Result(T value) : _value{ std::move(value) } {}
+		Result(std::error_code error) : _error{ error } {}
 
-	inline static const auto APPEND_READ = std::ios::app | std::ios::in;
+		bool has_value() const { return !_error; }
+		explicit operator bool() const { return has_value(); }
 
-	std::optional<fs::path> searchFile(const fs::directory_entry& directory, const std::string_view filename);
-	std::vector<fs::path> seachFiles(const fs::directory_entry& directory, const std::string_view filename);
+		T& value() { return _value; }
+		const T& value() const { return _value; }
 
-	template <typename Func, typename ReturnType = std::invoke_result_t<Func>>
-	std::pair<bool, ReturnType> safeIoOperation(Func func) {
-		try {
-			return { true, func() };
-		}
-		catch (const std::filesystem::filesystem_error& e) {
-			std::cerr << "Filesystem error: " << e.what() << '\n';
-		}
-		catch (const std::ios_base::failure& e) {
-			std::cerr << "I/O error: " << e.what() << '\n';
-		}
-		catch (const std::bad_alloc& e) {
-			std::cerr << "Memory allocation error: " << e.what() << '\n';
+		T& operator*() { return _value; }
+		const T& operator*() const { return _value; }
+
+		T* operator->() { return &_value; }
+		const T* operator->() const { return &_value; }
+
+		std::error_code error() const { return _error; }
+
+	private:
+		T _value{};
+		std::error_code _error{};
+	};
+
+	template <>
+	class Result<void> {
+	public:
+		Result() = default;
+		Result(std::error_code error) : _error{ error } {}
+
+		bool has_value() const { return !_error; }
+		explicit operator bool() const { return has_value(); }
+
+		std::error_code error() const { return _error; }
+
+	private:
+		std::error_code _error{};
+	};
+
+	struct WriteLocation {
+		data_file_id_t file_id{};
+		offset_t pos{};
+	};
+
+	using ReadResult = Result<char*>;
+	using WriteResult = Result<WriteLocation>;
+
+	inline static const auto APPEND_READ = std::ios::app | std::ios::in | std::ios::binary;
+
+	// Caller-owned bytes handed to a gather write, in the spirit of struct iovec.
+	struct IoSlice {
+		const char* data{};
+		size_t size{};
+	};
+
+	// Heap bytes whose ownership moves into the engine on write. The owner is released once
+	// the bytes have been handed to the file, so producers never pay for a copy.
+	class OwnedBuffer {
+	public:
+		OwnedBuffer() = default;
+
+		explicit OwnedBuffer(std::string&& value) {
+			auto owner = std::make_shared<std::string>(std::move(value));
+			_data = owner->data();
+			_size = owner->size();
+			_owner = std::move(owner);
 		}
-		catch (const std::exception& e) {
-			std::cerr << "General error: " << e.what() << '\n';
+
+		OwnedBuffer(std::unique_ptr<char[]> data, size_t size) : _data{ data.get() }, _size{ size }, _owner{ std::move(data) } {}
+
+		template <typename Deleter>
+		OwnedBuffer(const char* data, size_t size, Deleter deleter) : _data{ data }, _size{ size }, _owner{ data, std::move(deleter) } {}
+
+		const char* data() const { return _data; }
+		size_t size() const { return _size; }
+
+		IoSlice slice() const { return { _data, _size }; }
+
+		explicit operator bool() const { return _owner != nullptr; }
+
+	private:
+		const char* _data{};
+		size_t _size{};
+		std::shared_ptr<const void> _owner{};
+	};
+
+	inline size_t totalSize(std::span<const IoSlice> slices) {
+		size_t size{};
+		for (const auto& slice : slices) {
+			size += slice.size;
 		}
-		return { false, ReturnType{} };
+		return size;
 	}
 
+	// Thin positional I/O layer over the platform file API. Failures come back as error codes.
+	namespace native {
+		using handle_t = int;
+
+		inline constexpr handle_t INVALID_HANDLE{ -1 };
+
+		// Opens or creates a file for reading and writing. It can be renamed or replaced while open.
+		Result<handle_t> open(const fs::path& path);
+		void close(handle_t handle);
+		Result<uint64_t> size(handle_t handle);
+		Result<void> truncate(handle_t handle, uint64_t size);
+		Result<void> sync(handle_t handle);
+		Result<size_t> writeAt(handle_t handle, std::span<const IoSlice> slices, uint64_t offset);
+		Result<void> readAt(handle_t handle, char* buffer, size_t size, uint64_t offset);
+		// Makes the entries of a directory, such as a rename into it, durable.
+		Result<void> syncDirectory(const fs::path& path);
+		// Lets the OS reclaim the whole pages of a range of memory that is no longer needed;
+		// they read back as zeros or as their old bytes.
+		void discard(char* data, size_t size);
+	}
+
+	std::optional<fs::path> searchFile(const fs::directory_entry& directory, const std::string_view filename);
+	std::vector<fs::path> seachFiles(const fs::directory_entry& directory, const std::string_view filename);
+
 	class CharBuffer {
 	private:
-		std::mutex _mtx;
-		uint32_t _size{ 1'000'000'000 };
+		static constexpr uint32_t COMMIT_STEP{ 1024 * 1024 };
+		static constexpr uint32_t DEFAULT_SIZE{ 64 * 1024 * 1024 };
+		static constexpr uint32_t MIN_LAP{ 8 * 1024 * 1024 };
+		// Under a memory limit the ring wraps after at most this fraction of it.
+		static constexpr uint64_t LIMIT_SHARE{ 16 };
+		// Thread buffers up to this size are kept between reads; larger ones go with the next read.
+		static constexpr uint32_t THREAD_KEEP_SIZE{ COMMIT_STEP };
+
+		// Bytes of one thread for reads the ring cannot take, charged to the memory budget like the ring.
+		class ThreadBuffer {
+		public:
+			ThreadBuffer() = default;
+
+			ThreadBuffer(const ThreadBuffer&) = delete;
+			ThreadBuffer& operator=(const ThreadBuffer&) = delete;
+
+			~ThreadBuffer() {
+				resize(0);
+			}
+
+			// Null when the memory budget has no room for a buffer larger than THREAD_KEEP_SIZE.
+			char* get(uint32_t size) {
+				auto oversized = size < _size && ((_size > THREAD_KEEP_SIZE && size <= _size / 2) || memoryBudget().underPressure());
+
+				if ((size > _size || oversized) && !resize(size)) {
+					return nullptr;
+				}
+
+				return _buffer.get();
+			}
+
+			// Called on reads the ring took, once the previous buffer no longer has to stay valid.
+			void trim() {
+				if (_size > THREAD_KEEP_SIZE || (_size > 0 && memoryBudget().underPressure())) {
+					resize(0);
+				}
+			}
+
+		private:
+			std::unique_ptr<char[]> _buffer{};
+			uint32_t _size{};
+
+			bool resize(uint32_t size) {
+				_buffer.reset();
+				memoryBudget().release(MemoryComponent::ReadBuffer, _size);
+				_size = 0;
+
+				if (size == 0) {
+					return true;
+				}
+
+				// Small reads must work even with the budget spent, so only larger ones can be refused.
+				if (size <= THREAD_KEEP_SIZE) {
+					memoryBudget().reserve(MemoryComponent::ReadBuffer, size);
+				}
+				else if (!memoryBudget().tryReserve(MemoryComponent::ReadBuffer, size)) {
+					return false;
+				}
+
+				_buffer = std::make_unique_for_overwrite<char[]>(size);
+				_size = size;
+				return true;
+			}
+		};
+
+		ProfiledMutex<std::mutex> _mtx{ LockSite::ReadBuffer };
+		uint32_t _size{ DEFAULT_SIZE };
 		std::unique_ptr<char[]> _buffer{};
 		uint32_t _current_pos{};
+		// Where the ring wraps; see nextLap().
+		uint32_t _lap{};
+		// Leading bytes of the ring handed out so far and charged to the memory budget. The
+		// allocation is left uninitialized, so pages past this are never touched.
+		uint32_t _committed{};
+		// Committed bytes past this were last handed out before the current lap and are given
+		// back at the next wrap, a whole lap after anyone could still be reading them.
+		uint32_t _trim_to{};
+
+		bool commit(uint32_t end) {
+			auto target = static_cast<uint32_t>(std::min<uint64_t>(_lap, (uint64_t{ end } + COMMIT_STEP - 1) / COMMIT_STEP * COMMIT_STEP));
+
+			if (!memoryBudget().tryReserve(MemoryComponent::ReadBuffer, target - _committed)) {
+				return false;
+			}
+
+			_committed = target;
+			return true;
+		}
+
+		// A share of the memory limit, halved at every wrap under memory pressure, but never
+		// below MIN_LAP nor above the size of the ring.
+		uint32_t nextLap() const {
+			uint64_t lap{ _size };
+
+			if (auto limit = memoryBudget().limit()) {
+				lap = std::min(lap, limit / LIMIT_SHARE);
+			}
+			if (memoryBudget().underPressure()) {
+				lap = std::min<uint64_t>(lap, _lap / 2);
+			}
+
+			return static_cast<uint32_t>(std::min<uint64_t>(_size, std::max<uint64_t>(lap / COMMIT_STEP * COMMIT_STEP, MIN_LAP)));
+		}
+
+		void wrap() {
+			if (_committed > _trim_to) {
+				native::discard(_buffer.get() + _trim_to, _committed - _trim_to);
+				memoryBudget().release(MemoryComponent::ReadBuffer, _committed - _trim_to);
+				_committed = _trim_to;
+			}
+
+			_lap = nextLap();
+			_trim_to = _lap;
+			_current_pos = 0;
+		}
+
+		static ThreadBuffer& threadBuffer() {
+			thread_local ThreadBuffer buffer{};
+			return buffer;
+		}
 
 	public:
-		CharBuffer() : _buffer{ std::make_unique<char[]>(_size) } {};
-		explicit CharBuffer(uint32_t size) : _size{ size }, _buffer{ std::make_unique<char[]>(size) } {};
+		CharBuffer() : CharBuffer{ DEFAULT_SIZE } {};
+		explicit CharBuffer(uint32_t size) : _size{ size }, _buffer{ std::make_unique_for_overwrite<char[]>(size) }, _lap{ size } {
+			_lap = nextLap();
+			_trim_to = _lap;
+		};
+
+		CharBuffer(const CharBuffer&) = delete;
+		CharBuffer& operator=(const CharBuffer&) = delete;
+
+		~CharBuffer() {
+			memoryBudget().release(MemoryComponent::ReadBuffer, _committed);
+		}
+
+		// A region of the ring stays valid for a whole lap. Reads larger than a lap, or that the
+		// memory budget keeps the ring from growing for, get a buffer of the calling thread
+		// instead, valid until that thread's next read. Null when neither has room.
 		char* getBuffer(std::streamsize requestedSize) {
-			std::scoped_lock lck{ _mtx };
+			PhaseTimer timer{ Phase::BufferReserve };
 
-			if (requestedSize > _size) {
+			if (requestedSize < 0 || requestedSize >= std::streamsize{ UINT32_MAX }) {
 			   return nullptr;
 			}
 
-			if (_current_pos + requestedSize >= _size) {
-				_current_pos = 0;
+			auto size = static_cast<uint32_t>(requestedSize) + 1;
+			char* start{};
+
+			{
+				auto lck = lockTimed<std::scoped_lock>(_mtx);
+
+				if (size <= _lap && _current_pos + size > _lap) {
+					wrap();
+				}
+
+				if (_current_pos + size <= _lap && (_current_pos + size <= _committed || commit(_current_pos + size))) {
+					start = &_buffer[_current_pos];
+					_current_pos += size;
+				}
 			}
 
-			char* start = &_buffer[_current_pos];
-			_buffer[_current_pos + requestedSize] = '\0';
-			_current_pos += requestedSize + 1;
+			auto& spare = threadBuffer();
+			if (start) {
+				spare.trim();
+			}
+			else if (start = spare.get(size); !start) {
+				return nullptr;
+			}
 
+			start[requestedSize] = '\0';
 			return start;
 		}
 	};
 
+	inline CharBuffer& sharedReadBuffer() {
+		static CharBuffer buffer{};
+		return buffer;
+	}
+
 	class ConcurrentFile {
 	public:
 		ConcurrentFile() = default;
 
-		~ConcurrentFile() = default;
+		~ConcurrentFile() {
+			if (isOpen()) {
+				native::close(_fd);
+			}
+		}
 
 		ConcurrentFile(const ConcurrentFile&) = delete;
 		ConcurrentFile& operator=(const ConcurrentFile&) = delete;
 
-		ConcurrentFile(const fs::path& filePath, std::ios_base::openmode mode = APPEND_READ)
-			: _file_path{ filePath }, _writer{ filePath, mode } { 
-			if (!_writer.is_open()) {
-				throw std::invalid_argument("Unable to in file");
+		explicit ConcurrentFile(const fs::path& filePath) {
+			auto file = open(filePath);
+			if (!file) {
+				throw std::system_error(file.error(), "Unable to open " + filePath.string());
+			}
+
+			*this = std::move(*file);
+		}
+
+		// Non-throwing counterpart of the path constructor, for files opened on the write path.
+		static Result<ConcurrentFile> open(const fs::path& filePath) {
+			auto fd = native::open(filePath);
+			if (!fd) {
+				return fd.error();
+			}
+
+			ConcurrentFile file{};
+			file._file_path = filePath;
+			file._fd = *fd;
+
+			auto size = native::size(file._fd);
+			if (!size) {
+				return size.error();
 			}
 
-			_current_write_pos = _writer.tellp();
+			file._current_write_pos = *size;
+			return file;
 		}
 
 		ConcurrentFile(ConcurrentFile&& other) noexcept {
 			std::scoped_lock lock{ _mtx, other._mtx };
 			_file_path = std::move(other._file_path);
-			_writer = std::move(other._writer);
+			_fd = std::exchange(other._fd, native::INVALID_HANDLE);
+			_current_write_pos = other._current_write_pos;
 		}
 
 		ConcurrentFile& operator=(ConcurrentFile&& other) noexcept {
 			if (this != &other) {
 				std::scoped_lock lock{ _mtx, other._mtx };
+				if (isOpen()) {
+					native::close(_fd);
+				}
 				_file_path = std::move(other._file_path);
-				_writer = std::move(other._writer);
+				_fd = std::exchange(other._fd, native::INVALID_HANDLE);
+				_current_write_pos = other._current_write_pos;
 			}
 			return *this;
 		}
 		
-		std::pair<bool, char*> read(offset_t offset, std::streamsize size) const {
-			return safeIoOperation([this, &size, &offset] {
-				auto buffer = _char_buffer.getBuffer(size);
+		Result<char*> read(offset_t offset, std::streamsize size) const {
+			auto buffer = sharedReadBuffer().getBuffer(size);
 
-				if (!buffer) {
-					throw std::runtime_error("Unable to allocate buffer");
-				}
+			if (!buffer) {
+				return std::make_error_code(std::errc::not_enough_memory);
+			}
 
-				if(offset + size < _current_write_pos) {
-					readInternal(buffer, offset, size);
-				} else {
-					std::shared_lock lck{ _mtx };
-					readInternal(buffer, offset, size);
-				}
-				
-				return buffer;
-			});
+			PhaseTimer timer{ Phase::Syscall };
+			if (auto status = native::readAt(_fd, buffer, static_cast<size_t>(size), offset); !status) {
+				return status.error();
+			}
+
+			return buffer;
+		}
+
+		Result<offset_t> write(const char* value, std::streamsize size) {
+			IoSlice slice{ value, static_cast<size_t>(size) };
+			return write({ &slice, 1 });
 		}
 
-		std::pair<bool, offset_t> write(const char* value, std::streamsize size) {
-			return safeIoOperation([this, &value, &size] {
-				std::scoped_lock lck{ _mtx };
+		// Submits every slice with a single positional gather write, without staging them in a buffer.
+		// A failed write leaves the write position alone, so the next one overwrites whatever landed.
+		Result<offset_t> write(std::span<const IoSlice> slices) {
+			auto lck = lockTimed<std::scoped_lock>(_mtx);
 
-				auto pos = _current_write_pos;
-				
-				_writer.write(value, size);
+			auto pos = _current_write_pos;
 
-				_current_write_pos = _writer.tellp();
+			PhaseTimer timer{ Phase::Syscall };
+			auto written = native::writeAt(_fd, slices, pos);
+			if (!written) {
+				return written.error();
+			}
 
-				return pos;
-			});
+			_current_write_pos += *written;
+
+			return pos;
+		}
+
+		// Drops everything past size; later writes continue from there.
+		Result<void> truncate(offset_t size) {
+			std::scoped_lock lck{ _mtx };
+
+			if (auto status = native::truncate(_fd, size); !status) {
+				return status;
+			}
+
+			_current_write_pos = size;
+			return {};
+		}
+
+		// Forces written data to stable storage.
+		Result<void> sync() const {
+			return native::sync(_fd);
+		}
+
+		// Renames the file in place; the handle stays valid.
+		Result<void> rename(const fs::path& filePath) {
+			std::scoped_lock lck{ _mtx };
+
+			std::error_code ec{};
+			fs::rename(_file_path, filePath, ec);
+			if (ec) {
+				return ec;
+			}
+
+			_file_path = filePath;
+			return {};
 		}
 
 		bool isOpen() const {
-			return _writer.is_open();
+			return _fd != native::INVALID_HANDLE;
+		}
+
+		// Bytes written so far, which for a sealed file is its size.
+		offset_t size() const {
+			std::scoped_lock lck{ _mtx };
+			return _current_write_pos;
 		}
 
 		const fs::path& getPath() const {
@@ -153,18 +478,68 @@ namespace cosmo::storage {
 
 	private:
 		fs::path _file_path{};
+		native::handle_t _fd{ native::INVALID_HANDLE };
 		offset_t _current_write_pos{};
-		std::fstream _writer{};
-		mutable std::shared_mutex _mtx;
+		mutable ProfiledMutex<std::mutex> _mtx{ LockSite::DataFile };
+	};
+
+	// Copy-on-write table of immutable segments. Every append publishes a new
+	// array of segment handles, so readers only pay one atomic load and never
+	// observe a reallocation, while in-flight snapshots keep old arrays alive.
+	class SegmentTable {
+	public:
+		using Segment = std::shared_ptr<ConcurrentFile>;
+		using Segments = std::vector<Segment>;
+
+		class Snapshot {
+		public:
+			Snapshot() = default;
+			explicit Snapshot(std::shared_ptr<const Segments> segments) : _segments{ std::move(segments) } {}
+
+			size_t size() const { return _segments->size(); }
+			bool empty() const { return _segments->empty(); }
 
-		inline static CharBuffer _char_buffer{};
+			const ConcurrentFile& at(size_t index) const { return *_segments->at(index); }
+			const ConcurrentFile& operator[](size_t index) const { return *(*_segments)[index]; }
 
-		void readInternal(char* buffer, offset_t offset, std::streamsize size) const {
-			std::ifstream reader{ _file_path, std::ios::in };
+			Segment segment(size_t index) const { return _segments->at(index); }
 
-			reader.seekg(offset);
+		private:
+			std::shared_ptr<const Segments> _segments{ std::make_shared<const Segments>() };
+		};
 
-			reader.read(buffer, size);
+		SegmentTable() = default;
+
+		SegmentTable(const SegmentTable&) = delete;
+		SegmentTable& operator=(const SegmentTable&) = delete;
+
+		Snapshot load() const {
+			return Snapshot{ _segments.load(std::memory_order_acquire) };
 		}
+
+		void append(Segment segment) {
+			std::scoped_lock lck{ _write_mtx };
+
+			auto current = _segments.load(std::memory_order_relaxed);
+			auto next = std::make_shared<Segments>();
+			next->reserve(current->size() + 1);
+			next->assign(current->begin(), current->end());
+			next->emplace_back(std::move(segment));
+
+			_segments.store(std::move(next), std::memory_order_release);
+		}
+
+		void replace(size_t index, Segment segment) {
+			std::scoped_lock lck{ _write_mtx };
+
+			auto next = std::make_shared<Segments>(*_segments.load(std::memory_order_relaxed));
+			next->at(index) = std::move(segment);
+
+			_segments.store(std::move(next), std::memory_order_release);
+		}
+
+	private:
+		ProfiledMutex<std::mutex> _write_mtx{ LockSite::SegmentTable };
+		std::atomic<std::shared_ptr<const Segments>> _segments{ std::make_shared<const Segments>() };
 	};
 }
\ No newline at end of file
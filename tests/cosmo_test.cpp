@@ -0,0 +1,921 @@
+#include <cosmo.hpp>
+#include "keydir/keydir.hpp"
+#include "keydir/timer_wheel.hpp"
+#include "log/logger.hpp"
+#include "record/record.hpp"
+#include "stats/latency.hpp"
+#include "stats/lock_stats.hpp"
+#include "stats/phase_stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using cosmo::api::Cosmo;
+using cosmo::api::Options;
+
+class CosmoApiTest : public testing::Test {
+public:
+    std::filesystem::path directory{};
+    Options options{ 1'024 };
+
+    void SetUp() override {
+        directory = std::filesystem::temp_directory_path() / "cosmo_api_test";
+
+        std::filesystem::create_directories(directory);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(directory);
+    }
+};
+
+TEST_F(CosmoApiTest, putGet)
+{
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_TRUE(cosmo.put("jayz", "prodigy"));
+    EXPECT_TRUE(cosmo.put("goku", "vegeta"));
+    EXPECT_TRUE(cosmo.put("jayz", "50CENT"));
+
+    EXPECT_EQ(cosmo.get("jayz"), "50CENT");
+    EXPECT_EQ(cosmo.get("goku"), "vegeta");
+    EXPECT_FALSE(cosmo.get("citra"));
+}
+
+TEST_F(CosmoApiTest, deleteRemovesKey)
+{
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_TRUE(cosmo.put("jayz", "prodigy"));
+    EXPECT_TRUE(cosmo.del("jayz"));
+
+    EXPECT_FALSE(cosmo.get("jayz"));
+    EXPECT_FALSE(cosmo.del("jayz"));
+    EXPECT_EQ(cosmo.size(), 0);
+}
+
+TEST_F(CosmoApiTest, deleteSurvivesRestart)
+{
+    {
+        Cosmo cosmo{ directory, options };
+
+        for (auto i = 0; i < 100; ++i) {
+            EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(32, 'a' + i % 26)));
+        }
+
+        for (auto i = 0; i < 100; i += 2) {
+            EXPECT_TRUE(cosmo.del("key" + std::to_string(i)));
+        }
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.size(), 50);
+    EXPECT_FALSE(cosmo.get("key10"));
+    EXPECT_EQ(cosmo.get("key11"), std::string(32, 'a' + 11));
+}
+
+TEST_F(CosmoApiTest, mergeDropsDeadRecordsAndTombstones)
+{
+    auto directory_size = [this] {
+        uintmax_t size{};
+        for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+            size += entry.file_size();
+        }
+        return size;
+    };
+
+    {
+        Cosmo cosmo{ directory, options };
+
+        for (auto round = 0; round < 4; ++round) {
+            for (auto i = 0; i < 50; ++i) {
+                EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(32, 'a' + round)));
+            }
+        }
+
+        for (auto i = 0; i < 25; ++i) {
+            EXPECT_TRUE(cosmo.del("key" + std::to_string(i)));
+        }
+
+        for (auto i = 0; i < 50; ++i) {
+            EXPECT_TRUE(cosmo.put("filler" + std::to_string(i), std::string(32, 'z')));
+        }
+
+        auto size_before = directory_size();
+
+        EXPECT_TRUE(cosmo.merge());
+
+        EXPECT_LT(directory_size(), size_before);
+        EXPECT_FALSE(cosmo.get("key3"));
+        EXPECT_EQ(cosmo.get("key30"), std::string(32, 'd'));
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.size(), 75);
+    EXPECT_FALSE(cosmo.get("key3"));
+    EXPECT_EQ(cosmo.get("key30"), std::string(32, 'd'));
+    EXPECT_EQ(cosmo.get("filler7"), std::string(32, 'z'));
+}
+
+TEST_F(CosmoApiTest, damagedHintFallsBackToDataFile)
+{
+    {
+        Cosmo cosmo{ directory, options };
+
+        for (auto round = 0; round < 2; ++round) {
+            for (auto i = 0; i < 50; ++i) {
+                EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(32, 'a' + round)));
+            }
+        }
+
+        EXPECT_TRUE(cosmo.merge());
+    }
+
+    // Flipping the last byte of each hint changes a key while leaving the entry well formed.
+    size_t damaged{};
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (entry.path().filename().string().starts_with("hintfile") && entry.file_size() > 0) {
+            std::fstream hint{ entry.path(), std::ios::in | std::ios::out | std::ios::binary };
+            hint.seekg(-1, std::ios::end);
+            auto byte = static_cast<char>(hint.get() ^ 0x01);
+            hint.seekp(-1, std::ios::end);
+            hint.put(byte);
+            ++damaged;
+        }
+    }
+    ASSERT_GT(damaged, 0);
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.size(), 50);
+    for (auto i = 0; i < 50; ++i) {
+        EXPECT_EQ(cosmo.get("key" + std::to_string(i)), std::string(32, 'b'));
+    }
+}
+
+TEST_F(CosmoApiTest, staleHintIsIgnoredAfterRemerge)
+{
+    auto readHints = [this] {
+        std::vector<std::pair<std::filesystem::path, std::string>> hints{};
+        for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+            if (entry.path().filename().string().starts_with("hintfile")) {
+                std::ifstream hint{ entry.path(), std::ios::binary };
+                hints.emplace_back(entry.path(), std::string{ std::istreambuf_iterator<char>{ hint }, {} });
+            }
+        }
+        return hints;
+    };
+
+    std::vector<std::pair<std::filesystem::path, std::string>> stale{};
+
+    {
+        Cosmo cosmo{ directory, options };
+
+        for (auto i = 0; i < 50; ++i) {
+            EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(32, 'a')));
+        }
+        EXPECT_TRUE(cosmo.merge());
+
+        stale = readHints();
+
+        for (auto i = 0; i < 50; i += 3) {
+            EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(32, 'b')));
+        }
+        EXPECT_TRUE(cosmo.merge());
+    }
+    ASSERT_FALSE(stale.empty());
+
+    // As if the old hints had survived the second merge next to the rewritten data files.
+    for (const auto& [path, bytes] : stale) {
+        std::ofstream hint{ path, std::ios::binary | std::ios::trunc };
+        hint << bytes;
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.size(), 50);
+    for (auto i = 0; i < 50; ++i) {
+        EXPECT_EQ(cosmo.get("key" + std::to_string(i)), std::string(32, i % 3 == 0 ? 'b' : 'a'));
+    }
+}
+
+TEST_F(CosmoApiTest, expiredKeysReadAsMissing)
+{
+    {
+        Cosmo cosmo{ directory, options };
+
+        EXPECT_TRUE(cosmo.put("session", "token", std::chrono::milliseconds{ 50 }));
+        EXPECT_TRUE(cosmo.put("user", "jayz", std::chrono::hours{ 1 }));
+        EXPECT_EQ(cosmo.get("session"), "token");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 100 });
+
+        EXPECT_FALSE(cosmo.get("session"));
+        EXPECT_FALSE(cosmo.del("session"));
+        EXPECT_EQ(cosmo.get("user"), "jayz");
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_FALSE(cosmo.get("session"));
+    EXPECT_EQ(cosmo.get("user"), "jayz");
+    EXPECT_EQ(cosmo.size(), 1);
+}
+
+TEST_F(CosmoApiTest, timerWheelEvictsInBatches)
+{
+    cosmo::storage::TimerWheel wheel{ 0 };
+
+    for (auto i = 0; i < 10; ++i) {
+        wheel.schedule("key" + std::to_string(i), 5'000 + i * 100'000);
+    }
+
+    std::vector<cosmo::storage::TimerWheel::Timer> due{};
+
+    EXPECT_EQ(wheel.advance(4'000, 10, due), 0);
+    EXPECT_EQ(wheel.advance(5'000, 10, due), 1);
+    EXPECT_EQ(due.front().key, "key0");
+
+    due.clear();
+    EXPECT_EQ(wheel.advance(10'000'000, 4, due), 4);
+    EXPECT_EQ(wheel.advance(10'000'000, 10, due), 5);
+    EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST_F(CosmoApiTest, recordsUseCompactHeaders)
+{
+    {
+        Cosmo cosmo{ directory, options };
+
+        EXPECT_TRUE(cosmo.put("k", "v"));
+    }
+
+    uintmax_t data_size{};
+    for (const auto& entry : std::filesystem::directory_iterator{ directory }) {
+        data_size += entry.file_size();
+    }
+
+    // crc32c (4) + type (1) + one byte per varint (3) + key + value.
+    EXPECT_EQ(data_size, 10);
+
+    Cosmo cosmo{ directory, options };
+    EXPECT_EQ(cosmo.get("k"), "v");
+
+    cosmo::storage::BlobManifest manifest{ 6'000'000'000, { { 1, 5'000'000'000, 6'000'000'000 } } };
+    cosmo::storage::BlobManifest decoded{};
+
+    ASSERT_TRUE(cosmo::storage::decodeBlobManifest(cosmo::storage::encodeBlobManifest(manifest), decoded));
+    EXPECT_EQ(decoded.total_size, manifest.total_size);
+    ASSERT_EQ(decoded.chunks.size(), 1);
+    EXPECT_EQ(decoded.chunks[0].value_pos, 5'000'000'000);
+    EXPECT_EQ(decoded.chunks[0].size, 6'000'000'000);
+}
+
+TEST_F(CosmoApiTest, writeBatchAppliesAtomically)
+{
+    {
+        Cosmo cosmo{ directory, options };
+
+        EXPECT_TRUE(cosmo.put("goku", "vegeta"));
+
+        cosmo::api::WriteBatch batch{};
+        for (auto i = 0; i < 20; ++i) {
+            batch.put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        batch.del("goku");
+        batch.del("key3");
+
+        EXPECT_TRUE(cosmo.write(std::move(batch)));
+
+        EXPECT_FALSE(cosmo.get("goku"));
+        EXPECT_FALSE(cosmo.get("key3"));
+        EXPECT_EQ(cosmo.get("key7"), "value7");
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.size(), 19);
+    EXPECT_FALSE(cosmo.get("goku"));
+    EXPECT_EQ(cosmo.get("key19"), "value19");
+}
+
+TEST_F(CosmoApiTest, tornBatchIsIgnoredOnRestart)
+{
+    {
+        Cosmo cosmo{ directory, options };
+
+        EXPECT_TRUE(cosmo.put("goku", "vegeta"));
+
+        cosmo::api::WriteBatch batch{};
+        batch.put("jayz", "prodigy");
+        batch.del("goku");
+
+        EXPECT_TRUE(cosmo.write(std::move(batch)));
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        std::filesystem::resize_file(entry.path(), entry.file_size() - 1);
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.get("goku"), "vegeta");
+    EXPECT_FALSE(cosmo.get("jayz"));
+}
+
+TEST_F(CosmoApiTest, tornTailIsTruncatedOnRestart)
+{
+    std::filesystem::path active_file{};
+    uintmax_t valid_size{};
+
+    {
+        Cosmo cosmo{ directory, options };
+
+        EXPECT_TRUE(cosmo.put("goku", "vegeta"));
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        active_file = entry.path();
+        valid_size = entry.file_size();
+    }
+
+    {
+        std::ofstream garbage{ active_file, std::ios::app | std::ios::binary };
+        garbage << "torn record";
+    }
+
+    {
+        Cosmo cosmo{ directory, options };
+
+        EXPECT_EQ(std::filesystem::file_size(active_file), valid_size);
+        EXPECT_TRUE(cosmo.put("jayz", "prodigy"));
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.get("goku"), "vegeta");
+    EXPECT_EQ(cosmo.get("jayz"), "prodigy");
+}
+
+TEST_F(CosmoApiTest, crc32cMatchesKnownVectors)
+{
+    EXPECT_EQ(cosmo::storage::crc32c(""), 0);
+    EXPECT_EQ(cosmo::storage::crc32c("123456789"), 0xE3069283);
+
+    std::string data(1'000, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 31 + 7);
+    }
+
+    // Splitting at any point, including unaligned ones, must give the same checksum.
+    auto whole = cosmo::storage::crc32c(data);
+    for (size_t split : { 1, 7, 8, 13, 500, 999 }) {
+        std::string_view view{ data };
+        EXPECT_EQ(cosmo::storage::crc32c(view.substr(split), cosmo::storage::crc32c(view.substr(0, split))), whole);
+    }
+}
+
+TEST_F(CosmoApiTest, scrubReportsCorruptRanges)
+{
+    std::vector<cosmo::api::CorruptRange> reported{};
+    options.on_corruption = [&reported](const cosmo::api::CorruptRange& range) {
+        reported.push_back(range);
+    };
+
+    Cosmo cosmo{ directory, options };
+
+    for (auto i = 0; i < 100; ++i) {
+        EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(100, 'v')));
+    }
+
+    EXPECT_EQ(cosmo.scrub(), 0);
+    EXPECT_TRUE(reported.empty());
+
+    auto data_file = directory / "datafile_0.cosmo";
+    auto data_file_size = std::filesystem::file_size(data_file);
+    {
+        std::fstream file{ data_file, std::ios::in | std::ios::out | std::ios::binary };
+        file.seekp(200);
+        file.put('\x7F');
+    }
+
+    EXPECT_EQ(cosmo.scrub(), 1);
+    ASSERT_EQ(reported.size(), 1);
+    EXPECT_EQ(reported[0].file_id, 0);
+    EXPECT_LE(reported[0].begin, 200);
+    EXPECT_EQ(reported[0].end, data_file_size);
+
+    auto stats = cosmo.scrubStats();
+    EXPECT_EQ(stats.passes, 2);
+    EXPECT_EQ(stats.corrupt_ranges, 1);
+    EXPECT_GT(stats.bytes_verified, data_file_size);
+}
+
+TEST_F(CosmoApiTest, loggerFiltersAndRateLimits)
+{
+    using cosmo::storage::LogEvent;
+    using cosmo::storage::LogLevel;
+
+    cosmo::storage::Logger logger{};
+    std::vector<std::string> lines{};
+
+    logger.setSink([&lines](LogLevel, std::string_view line) { lines.emplace_back(line); });
+    logger.setRateLimit(5);
+
+    for (auto i = 0; i < 100; ++i) {
+        logger.log(LogLevel::Error, LogEvent::WriteFailed, "write {} failed", i);
+    }
+    logger.log(LogLevel::Error, LogEvent::ReadFailed, "read failed");
+    logger.log(LogLevel::Debug, LogEvent::ReadFailed, "not shown");
+
+    logger.flush();
+
+    ASSERT_EQ(lines.size(), 6);
+    EXPECT_EQ(lines.front(), "cosmo error: write 0 failed");
+    EXPECT_EQ(lines.back(), "cosmo error: read failed");
+}
+
+TEST_F(CosmoApiTest, largeValuesBypassWriteBuffer)
+{
+    std::string small(100, 's');
+    std::string large(256 * 1024, 'l');
+
+    {
+        Cosmo cosmo{ directory, Options{ 1'000'000 } };
+
+        EXPECT_TRUE(cosmo.put("small1", small));
+        EXPECT_TRUE(cosmo.put("large", large));
+        EXPECT_TRUE(cosmo.put("small2", small));
+
+        EXPECT_EQ(cosmo.get("small1"), small);
+        EXPECT_EQ(cosmo.get("large"), large);
+        EXPECT_EQ(cosmo.get("small2"), small);
+    }
+
+    Cosmo cosmo{ directory, Options{ 1'000'000 } };
+
+    EXPECT_EQ(cosmo.get("small1"), small);
+    EXPECT_EQ(cosmo.get("large"), large);
+    EXPECT_EQ(cosmo.get("small2"), small);
+}
+
+TEST_F(CosmoApiTest, streamValueLargerThanDataFile)
+{
+    Options stream_options{ 4'096, 1'000 };
+    std::string expected{};
+
+    {
+        Cosmo cosmo{ directory, stream_options };
+
+        auto stream = cosmo.openWriteStream("blob");
+        for (auto i = 0; i < 50; ++i) {
+            std::string piece(777, static_cast<char>('a' + i % 26));
+            expected += piece;
+            EXPECT_TRUE(stream.append(piece));
+        }
+
+        EXPECT_FALSE(cosmo.get("blob"));
+        EXPECT_TRUE(stream.close());
+        EXPECT_EQ(stream.size(), expected.size());
+
+        EXPECT_TRUE(cosmo.put("small", "value"));
+        EXPECT_EQ(cosmo.get("blob"), expected);
+    }
+
+    Cosmo cosmo{ directory, stream_options };
+
+    EXPECT_TRUE(cosmo.merge());
+
+    auto reader = cosmo.openReadStream("blob");
+    ASSERT_TRUE(reader);
+    EXPECT_EQ(reader->size(), expected.size());
+
+    std::string streamed{};
+    std::vector<char> piece(500);
+    while (auto count = reader->read(piece)) {
+        streamed.append(piece.data(), count);
+    }
+
+    EXPECT_TRUE(reader->good());
+    EXPECT_EQ(streamed, expected);
+    EXPECT_EQ(cosmo.get("small"), "value");
+}
+
+TEST_F(CosmoApiTest, unfinishedStreamIsInvisible)
+{
+    Options stream_options{ 4'096, 1'000 };
+
+    {
+        Cosmo cosmo{ directory, stream_options };
+
+        auto stream = cosmo.openWriteStream("blob");
+        EXPECT_TRUE(stream.append(std::string(10'000, 'x')));
+    }
+
+    Cosmo cosmo{ directory, stream_options };
+
+    EXPECT_FALSE(cosmo.get("blob"));
+    EXPECT_FALSE(cosmo.openReadStream("blob"));
+    EXPECT_EQ(cosmo.size(), 0);
+}
+
+TEST_F(CosmoApiTest, histogramPercentilesStayWithinPrecision)
+{
+    cosmo::storage::Histogram histogram{};
+
+    for (uint64_t value = 1; value <= 100'000; ++value) {
+        histogram.record(value * 1'000);
+    }
+
+    EXPECT_EQ(histogram.count(), 100'000);
+    EXPECT_EQ(histogram.min(), 1'000);
+    EXPECT_EQ(histogram.max(), 100'000'000);
+
+    for (double percentile : { 50.0, 90.0, 99.0, 99.9 }) {
+        auto exact = static_cast<double>(percentile * 1'000'000);
+        auto reported = static_cast<double>(histogram.percentile(percentile));
+
+        EXPECT_NEAR(reported, exact, exact / 64);
+    }
+}
+
+TEST_F(CosmoApiTest, exitedThreadsHandBackHistograms)
+{
+    cosmo::storage::HistogramRecorder<2> recorder{};
+
+    for (auto i = 0; i < 32; ++i) {
+        std::thread{ [&recorder, i] { recorder.record(i % 2, 1'000); } }.join();
+    }
+
+    EXPECT_EQ(recorder.threadSlots(), 1);
+    EXPECT_EQ(recorder.snapshot(0).count(), 16);
+    EXPECT_EQ(recorder.snapshot(1).count(), 16);
+
+    std::vector<std::thread> threads{};
+    for (auto i = 0; i < 4; ++i) {
+        threads.emplace_back([&recorder] { recorder.record(0, 1'000); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_LE(recorder.threadSlots(), 4);
+    EXPECT_EQ(recorder.snapshot(0).count(), 20);
+}
+
+TEST_F(CosmoApiTest, statsCountOperationsAcrossThreads)
+{
+    Cosmo cosmo{ directory, options };
+
+    std::vector<std::thread> writers{};
+    for (int t = 0; t < 4; ++t) {
+        writers.emplace_back([&cosmo, t] {
+            for (int i = 0; i < 50; ++i) {
+                cosmo.put("key" + std::to_string(t) + "_" + std::to_string(i), std::string(40, 'v'));
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    for (int i = 0; i < 50; ++i) {
+        EXPECT_TRUE(cosmo.get("key0_" + std::to_string(i)));
+    }
+
+    EXPECT_TRUE(cosmo.sync());
+    EXPECT_TRUE(cosmo.merge());
+
+    auto stats = cosmo.getStats();
+
+    EXPECT_EQ(stats.write.count, 200);
+    EXPECT_GE(stats.read.count, 50);
+    EXPECT_GT(stats.rollover.count, 0);
+    EXPECT_EQ(stats.fsync.count, 1);
+    EXPECT_EQ(stats.merge.count, 1);
+    EXPECT_LE(stats.write.min, stats.write.p50);
+    EXPECT_LE(stats.write.p50, stats.write.p99);
+    EXPECT_LE(stats.write.p99, stats.write.max);
+}
+
+TEST_F(CosmoApiTest, ioStatsTrackAmplification)
+{
+    Cosmo cosmo{ directory, options };
+
+    std::string value(50, 'v');
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            EXPECT_TRUE(cosmo.put("key" + std::to_string(i + 100), value));
+        }
+    }
+    EXPECT_TRUE(cosmo.sync());
+
+    auto io = cosmo.getStats().io;
+    uint64_t live = 100 * (6 + value.size());
+
+    EXPECT_EQ(io.user_bytes_written, 2 * live);
+    EXPECT_GT(io.data_bytes_written, io.user_bytes_written);
+    EXPECT_GE(io.fsyncs, 1);
+    EXPECT_EQ(io.live_bytes, live);
+    EXPECT_EQ(io.disk_bytes, io.data_bytes_written);
+    EXPECT_EQ(io.merge_bytes_written, 0);
+
+    EXPECT_TRUE(cosmo.merge());
+    EXPECT_TRUE(cosmo.del("key100"));
+
+    auto merged = cosmo.getStats().io;
+
+    EXPECT_GT(merged.merge_bytes_read, merged.merge_bytes_written);
+    EXPECT_GT(merged.hint_bytes_written, 0);
+    // Each merged file and its hint are synced, and so is the directory after renaming them in.
+    EXPECT_GE(merged.fsyncs, io.fsyncs + 4);
+    EXPECT_LT(merged.disk_bytes, io.disk_bytes + merged.hint_bytes_written);
+    EXPECT_EQ(merged.live_bytes, live - 6 - value.size());
+}
+
+TEST_F(CosmoApiTest, diskBytesFollowFilesWithoutStatting)
+{
+    auto directory_size = [this] {
+        uintmax_t size{};
+        for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+            size += entry.file_size();
+        }
+        return size;
+    };
+
+    {
+        Cosmo cosmo{ directory, options };
+
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 40; ++i) {
+                EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(40, 'a' + round)));
+            }
+        }
+        EXPECT_TRUE(cosmo.sync());
+        EXPECT_EQ(cosmo.getStats().io.disk_bytes, directory_size());
+
+        EXPECT_TRUE(cosmo.merge());
+        EXPECT_TRUE(cosmo.merge());
+        EXPECT_TRUE(cosmo.sync());
+        EXPECT_EQ(cosmo.getStats().io.disk_bytes, directory_size());
+    }
+
+    Cosmo cosmo{ directory, options };
+
+    EXPECT_EQ(cosmo.getStats().io.disk_bytes, directory_size());
+}
+
+TEST_F(CosmoApiTest, lockStatsFollowProfilingBuild)
+{
+    Cosmo cosmo{ directory, options };
+
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(cosmo.put("key" + std::to_string(i), "value"));
+        EXPECT_TRUE(cosmo.get("key" + std::to_string(i)));
+    }
+
+    auto locks = cosmo.getStats().locks;
+
+    if constexpr (!cosmo::storage::LOCK_PROFILING) {
+        EXPECT_TRUE(locks.empty());
+        return;
+    }
+
+    auto strategy = std::find_if(locks.begin(), locks.end(), [](const auto& lock) { return lock.site == "strategy" && !lock.shared; });
+    ASSERT_NE(strategy, locks.end());
+    EXPECT_GE(strategy->acquisitions, 20);
+    EXPECT_LE(strategy->contended, strategy->acquisitions);
+    EXPECT_EQ(strategy->hold.count, strategy->acquisitions);
+}
+
+TEST_F(CosmoApiTest, phaseStatsFollowProfilingBuild)
+{
+    Cosmo cosmo{ directory, options };
+    cosmo::storage::phaseProfiler().reset();
+
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(cosmo.put("key" + std::to_string(i), "value"));
+        EXPECT_TRUE(cosmo.get("key" + std::to_string(i)));
+    }
+
+    auto phases = cosmo.getStats().phases;
+
+    if constexpr (!cosmo::storage::PHASE_PROFILING) {
+        EXPECT_TRUE(phases.empty());
+        return;
+    }
+
+    uint64_t reads{};
+    uint64_t writes{};
+    for (const auto& thread : phases) {
+        (thread.operation == "read" ? reads : writes) += thread.operations;
+
+        auto attributed = thread.lock_wait + thread.buffer_reserve + thread.copy + thread.syscall + thread.checksum + thread.index;
+        EXPECT_LE(attributed, thread.total);
+        EXPECT_GT(thread.index, 0);
+
+        if (thread.operation == "write") {
+            EXPECT_GT(thread.checksum, 0);
+        }
+        else {
+            EXPECT_GT(thread.copy, 0);
+        }
+    }
+
+    EXPECT_EQ(reads, 20);
+    EXPECT_EQ(writes, 20);
+}
+
+TEST_F(CosmoApiTest, exitedThreadsHandBackPhaseTotals)
+{
+    cosmo::storage::PhaseProfiler profiler{};
+
+    for (auto i = 0; i < 32; ++i) {
+        std::thread{ [&profiler] {
+            cosmo::storage::PhaseProfiler::add(profiler.local().operations[0].operations, 1);
+        } }.join();
+    }
+
+    auto stats = profiler.stats();
+    ASSERT_EQ(stats.size(), 1);
+    EXPECT_EQ(stats[0].operations[0].operations, 32);
+}
+
+TEST_F(CosmoApiTest, metricsEndpointServesPrometheusText)
+{
+    options.metrics_port = 0;
+    Cosmo cosmo{ directory, options };
+
+    for (int i = 0; i < 30; ++i) {
+        EXPECT_TRUE(cosmo.put("key" + std::to_string(i), std::string(64, 'v')));
+    }
+    EXPECT_TRUE(cosmo.merge());
+
+    auto text = cosmo.metrics();
+    EXPECT_NE(text.find("# TYPE cosmo_operation_duration_seconds histogram\n"), std::string::npos);
+    EXPECT_NE(text.find("cosmo_operation_duration_seconds_count{operation=\"write\"} 30\n"), std::string::npos);
+    EXPECT_NE(text.find("cosmo_operation_duration_seconds_bucket{operation=\"write\",le=\"+Inf\"} 30\n"), std::string::npos);
+    EXPECT_NE(text.find("cosmo_keys 30\n"), std::string::npos);
+    EXPECT_NE(text.find("cosmo_merges_total 1\n"), std::string::npos);
+    EXPECT_NE(text.find("cosmo_merge_running 0\n"), std::string::npos);
+
+    auto gauges = cosmo.getStats().gauges;
+    EXPECT_GT(gauges.data_files, 0);
+    EXPECT_EQ(gauges.merge.files_done, gauges.merge.files);
+    EXPECT_LE(gauges.write_buffer_bytes, gauges.write_buffer_capacity);
+
+    ASSERT_NE(cosmo.metricsPort(), 0);
+
+#ifndef _WIN32
+    auto request = [&cosmo](std::string_view path) {
+        auto client = ::socket(AF_INET, SOCK_STREAM, 0);
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(cosmo.metricsPort());
+
+        std::string response{};
+        if (::connect(client, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0) {
+            auto line = "GET " + std::string{ path } + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            ::send(client, line.data(), line.size(), 0);
+
+            char chunk[4'096];
+            for (ssize_t received{}; (received = ::recv(client, chunk, sizeof(chunk), 0)) > 0;) {
+                response.append(chunk, static_cast<size_t>(received));
+            }
+        }
+        ::close(client);
+
+        return response;
+    };
+
+    auto response = request("/metrics");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n"));
+    EXPECT_NE(response.find("cosmo_keys 30\n"), std::string::npos);
+
+    EXPECT_TRUE(request("/other").starts_with("HTTP/1.1 404 Not Found\r\n"));
+#endif
+}
+
+TEST_F(CosmoApiTest, memoryLimitRefusesNewKeysAndShrinksBuffers)
+{
+    Cosmo cosmo{ directory, options };
+    EXPECT_TRUE(cosmo.put("key0", "value"));
+
+    auto before = cosmo::api::memoryUsage();
+    EXPECT_GT(before.keydir, 0);
+    EXPECT_GT(before.write_buffers, 0);
+    EXPECT_EQ(before.total, before.keydir + before.write_buffers + before.read_buffer);
+
+    cosmo::api::setMemoryLimit(before.total + 10 * cosmo::storage::KeyDir::entryMemory("key0"));
+
+    int accepted{};
+    while (accepted < 100 && cosmo.put("key" + std::to_string(accepted + 1), "value")) {
+        ++accepted;
+    }
+    EXPECT_GT(accepted, 0);
+    EXPECT_LE(accepted, 10);
+
+    // Overwrites do not grow the keydir and are still accepted.
+    EXPECT_TRUE(cosmo.put("key0", "other"));
+    EXPECT_EQ(cosmo.get("key0"), "other");
+
+    // Near the limit a flushed write buffer hands its memory back.
+    EXPECT_TRUE(cosmo.sync());
+    EXPECT_EQ(cosmo::api::memoryUsage().write_buffers, 0);
+    EXPECT_TRUE(cosmo.put("key0", "again"));
+
+    cosmo::api::setMemoryLimit(0);
+    EXPECT_TRUE(cosmo.put("key" + std::to_string(accepted + 1), "value"));
+}
+
+TEST_F(CosmoApiTest, concurrentGetsUnderMemoryLimitKeepTheirBytes)
+{
+    Cosmo cosmo{ directory, Options{ 64 * 1024 * 1024 } };
+
+    constexpr size_t value_size{ 200 * 1024 };
+    for (char c = 'a'; c < 'i'; ++c) {
+        EXPECT_TRUE(cosmo.put(std::string{ c }, std::string(value_size, c)));
+    }
+    EXPECT_TRUE(cosmo.sync());
+
+    // Room for a buffer per reader but not for the first step of the shared read ring, so
+    // readers must not share it.
+    cosmo::api::setMemoryLimit(cosmo::api::memoryUsage().total + 4 * (value_size + 1));
+
+    std::atomic<int> mismatches{};
+    std::vector<std::thread> readers{};
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&cosmo, &mismatches, t] {
+            for (int i = 0; i < 100; ++i) {
+                auto key = static_cast<char>('a' + (t + i) % 8);
+                if (cosmo.get(std::string{ key }) != std::string(value_size, key)) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    cosmo::api::setMemoryLimit(0);
+
+    EXPECT_EQ(mismatches, 0);
+}
+
+TEST_F(CosmoApiTest, getsDuringMergeSeeCurrentValues)
+{
+    Cosmo cosmo{ directory, options };
+
+    auto value = [](int i) { return "value" + std::to_string(i) + std::string(20, 'v'); };
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 200; ++i) {
+            EXPECT_TRUE(cosmo.put("key" + std::to_string(i), value(i)));
+        }
+    }
+    EXPECT_TRUE(cosmo.sync());
+
+    std::atomic<bool> merging{ true };
+    std::atomic<int> mismatches{};
+    std::vector<std::thread> readers{};
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&] {
+            while (merging) {
+                for (int i = 0; i < 200; ++i) {
+                    if (cosmo.get("key" + std::to_string(i)) != value(i)) {
+                        ++mismatches;
+                    }
+                }
+            }
+        });
+    }
+
+    for (int merge = 0; merge < 3; ++merge) {
+        EXPECT_TRUE(cosmo.merge());
+    }
+    merging = false;
+
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(mismatches, 0);
+}
@@ -14,6 +14,10 @@
 #include <chrono>
 #include <random>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
 
 using cosmo::storage::Storage;
 class CosmoTest : public testing::Test {
@@ -34,12 +38,13 @@ public:
 
 auto testRead(Storage& storage, cosmo::storage::data_file_id_t fileIndex, cosmo::storage::offset_t offset, cosmo::storage::data_file_size_t length, const std::string& expected) {
     auto start = std::chrono::high_resolution_clock::now();
-    auto [status, buffer] = storage.read(fileIndex, offset, length);
+    auto buffer = storage.read(fileIndex, offset, length);
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> elapsed = end - start;
-    EXPECT_TRUE(status);
-    auto str = std::string(buffer);
-    EXPECT_EQ(expected, str);
+    EXPECT_TRUE(buffer);
+    if (buffer) {
+        EXPECT_EQ(expected, std::string(*buffer));
+    }
 
     return elapsed.count();
 }
@@ -171,9 +176,10 @@ TEST_F(CosmoTest, simpleWrite)
 
     std::string value = "Hello, world!";
 
-    auto [writeSuccess, id, pos] = storage.write(value);
+    auto writeResult = storage.write(value);
+    ASSERT_TRUE(writeResult);
 
-    EXPECT_TRUE(writeSuccess);
+    auto [id, pos] = *writeResult;
 
     EXPECT_EQ(id, 0);
 
@@ -186,9 +192,10 @@ TEST_F(CosmoTest, writeEmptyString)
 
     std::string value = "";
 
-    auto [writeSuccess, id, pos] = storage.write(value);
+    auto writeResult = storage.write(value);
+    ASSERT_TRUE(writeResult);
 
-    EXPECT_TRUE(writeSuccess);
+    auto [id, pos] = *writeResult;
 
     EXPECT_EQ(id, 0);
 
@@ -201,9 +208,10 @@ TEST_F(CosmoTest, writeLargeString)
 
     std::string value(1'000'000, 'a');
 
-    auto [writeSuccess, id, pos] = storage.write(value);
+    auto writeResult = storage.write(value);
+    ASSERT_TRUE(writeResult);
 
-    EXPECT_TRUE(writeSuccess);
+    auto [id, pos] = *writeResult;
 
     EXPECT_EQ(id, 0);
 
@@ -216,9 +224,10 @@ TEST_F(CosmoTest, writeSpecialCharacters)
 
     std::string value = "Hello, world! 😊👍🌍";
 
-    auto [writeSuccess, id, pos] = storage.write(value);
+    auto writeResult = storage.write(value);
+    ASSERT_TRUE(writeResult);
 
-    EXPECT_TRUE(writeSuccess);
+    auto [id, pos] = *writeResult;
 
     EXPECT_EQ(id, 0);
 
@@ -235,14 +244,209 @@ TEST_F(CosmoTest, writeMultipleValues)
         "Multiple writes test! 📝🔄"
     };
 
-    std::streampos expectedPos = 0;
+    cosmo::storage::offset_t expectedPos = 0;
 
     for (const auto& value : values) {
-        auto [writeSuccess, id, pos] = storage.write(value);
-
-        EXPECT_TRUE(writeSuccess);
-        EXPECT_EQ(pos, expectedPos);
+        auto writeResult = storage.write(value);
+        ASSERT_TRUE(writeResult);
+        EXPECT_EQ(writeResult->pos, expectedPos);
 
         expectedPos += value.size();
     }
 }
+
+TEST_F(CosmoTest, dataFilesSnapshotStableAcrossRollover)
+{
+    Storage storage{ directory, 16 };
+
+    auto snapshot = storage.getDataFiles();
+
+    std::string value(64, 'a');
+
+    for (auto i = 0; i < 4; ++i) {
+        EXPECT_TRUE(storage.write(value));
+    }
+
+    EXPECT_TRUE(snapshot.empty());
+    EXPECT_EQ(storage.getDataFiles().size(), storage.getActiveFileId());
+
+    testRead(storage, 1, 0, 64, value);
+}
+
+TEST_F(CosmoTest, writeViewsAndSlices)
+{
+    Storage storage{ directory };
+
+    std::string_view view = "jayzprodigy";
+    std::vector<std::byte> bytes(6, std::byte{ 'g' });
+    std::string goku = "goku";
+    std::string vegeta = "vegeta";
+    const cosmo::storage::IoSlice slices[]{ { goku.data(), goku.size() }, { vegeta.data(), vegeta.size() } };
+
+    auto viewResult = storage.write(view);
+    auto bytesResult = storage.write(std::span<const std::byte>{ bytes });
+    auto slicesResult = storage.write(slices);
+
+    ASSERT_TRUE(viewResult);
+    ASSERT_TRUE(bytesResult);
+    ASSERT_TRUE(slicesResult);
+
+    auto [viewId, viewPos] = *viewResult;
+    auto [bytesId, bytesPos] = *bytesResult;
+    auto [slicesId, slicesPos] = *slicesResult;
+
+    EXPECT_EQ(bytesPos, 11);
+    EXPECT_EQ(slicesPos, 17);
+
+    testRead(storage, viewId, viewPos, 11, "jayzprodigy");
+    testRead(storage, bytesId, bytesPos, 6, "gggggg");
+    testRead(storage, slicesId, slicesPos, 10, "gokuvegeta");
+}
+
+TEST_F(CosmoTest, writeAcceptsStringLiterals)
+{
+    Storage storage{ directory };
+
+    auto literalResult = storage.write("jayz");
+    auto temporaryResult = storage.write(std::string{ "prodigy" });
+
+    ASSERT_TRUE(literalResult);
+    ASSERT_TRUE(temporaryResult);
+
+    testRead(storage, literalResult->file_id, literalResult->pos, 4, "jayz");
+    testRead(storage, temporaryResult->file_id, temporaryResult->pos, 7, "prodigy");
+}
+
+TEST_F(CosmoTest, writeAdoptsOwnedBuffers)
+{
+    Storage storage{ directory };
+
+    auto released = std::make_shared<bool>(false);
+    auto data = std::make_unique<char[]>(6);
+    std::memcpy(data.get(), "vegeta", 6);
+    auto raw = data.release();
+
+    auto stringResult = storage.writeOwned(std::string{ "jayzprodigy" });
+    auto ownedResult = storage.writeOwned(cosmo::storage::OwnedBuffer{ raw, 6, [released](const char* ptr) {
+        *released = true;
+        delete[] ptr;
+    } });
+
+    ASSERT_TRUE(stringResult);
+    ASSERT_TRUE(ownedResult);
+
+    auto [stringId, stringPos] = *stringResult;
+    auto [ownedId, ownedPos] = *ownedResult;
+    EXPECT_EQ(ownedPos, 11);
+
+    testRead(storage, stringId, stringPos, 11, "jayzprodigy");
+    testRead(storage, ownedId, ownedPos, 6, "vegeta");
+
+    EXPECT_FALSE(*released);
+    EXPECT_TRUE(storage.flush());
+    EXPECT_TRUE(*released);
+
+    testRead(storage, ownedId, ownedPos, 6, "vegeta");
+}
+
+TEST_F(CosmoTest, readPastEndReportsError)
+{
+    Storage storage{ directory, 16 };
+
+    std::string value(64, 'a');
+
+    EXPECT_TRUE(storage.write(value));
+    EXPECT_TRUE(storage.write(value));
+
+    auto buffer = storage.read(0, 1'000, 10);
+
+    EXPECT_FALSE(buffer);
+    EXPECT_EQ(buffer.error(), std::errc::io_error);
+}
+
+TEST_F(CosmoTest, readOfUnknownFileReportsError)
+{
+    for (auto strategy : { cosmo::storage::StorageStrategyKind::Basic, cosmo::storage::StorageStrategyKind::Buffered }) {
+        Storage storage{ directory, 16, strategy };
+
+        EXPECT_TRUE(storage.write(std::string(64, 'a')));
+
+        auto buffer = storage.read(storage.getActiveFileId() + 5, 0, 10);
+
+        EXPECT_FALSE(buffer);
+        EXPECT_EQ(buffer.error(), std::errc::invalid_argument);
+    }
+}
+
+TEST_F(CosmoTest, flushesTriggeredByWritesAreTimed)
+{
+    Storage storage{ directory, 4'096 };
+
+    std::string value(100, 'a');
+    for (auto i = 0; i < 100; ++i) {
+        EXPECT_TRUE(storage.write(value));
+    }
+    EXPECT_TRUE(storage.write(std::string(64 * 1'024, 'b')));
+
+    EXPECT_GT(storage.getStats().flush.count, 0);
+}
+
+TEST_F(CosmoTest, readRingWrapsWithinItsLap)
+{
+    using cosmo::storage::MemoryComponent;
+    auto& budget = cosmo::storage::memoryBudget();
+
+    cosmo::storage::CharBuffer buffer{};
+    for (auto i = 0; i < 200; ++i) {
+        ASSERT_NE(buffer.getBuffer(1024 * 1024), nullptr);
+    }
+
+    EXPECT_LE(budget.used(MemoryComponent::ReadBuffer), 64 * 1024 * 1024);
+}
+
+TEST_F(CosmoTest, readRingShrinksUnderMemoryPressure)
+{
+    using cosmo::storage::MemoryComponent;
+    auto& budget = cosmo::storage::memoryBudget();
+    constexpr uint64_t mib{ 1024 * 1024 };
+
+    budget.setLimit(256 * mib);
+
+    cosmo::storage::CharBuffer buffer{};
+    for (auto i = 0; i < 16; ++i) {
+        ASSERT_NE(buffer.getBuffer(mib), nullptr);
+    }
+    EXPECT_GT(budget.used(MemoryComponent::ReadBuffer), 8 * mib);
+
+    budget.reserve(MemoryComponent::KeyDir, 240 * mib);
+    ASSERT_TRUE(budget.underPressure());
+
+    for (auto i = 0; i < 64; ++i) {
+        ASSERT_NE(buffer.getBuffer(mib), nullptr);
+    }
+    EXPECT_LE(budget.used(MemoryComponent::ReadBuffer), 8 * mib);
+
+    budget.release(MemoryComponent::KeyDir, 240 * mib);
+    budget.setLimit(0);
+}
+
+TEST_F(CosmoTest, largeReadBuffersGoWithTheNextRead)
+{
+    using cosmo::storage::MemoryComponent;
+    auto& budget = cosmo::storage::memoryBudget();
+    constexpr uint64_t large{ 100 * 1024 * 1024 };
+
+    cosmo::storage::CharBuffer buffer{};
+
+    ASSERT_NE(buffer.getBuffer(large), nullptr);
+    EXPECT_GT(budget.used(MemoryComponent::ReadBuffer), large);
+
+    ASSERT_NE(buffer.getBuffer(100), nullptr);
+    EXPECT_LT(budget.used(MemoryComponent::ReadBuffer), large);
+
+    // Past the limit the read is refused instead of overshooting it.
+    budget.setLimit(budget.used() + 1024 * 1024);
+    EXPECT_EQ(buffer.getBuffer(large), nullptr);
+    EXPECT_LE(budget.used(), budget.limit());
+    budget.setLimit(0);
+}